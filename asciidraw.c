@@ -1,527 +1,8500 @@
+#define _GNU_SOURCE
+
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <malloc.h>
 #include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /*
  * The maximum number of arguments a command
  * can take.
  */
-const int ARGS_MAX = 4;
+#define ARGS_MAX 4
 
 /*
- * All available commands the interpreter
- * can evaluate.
+ * The stream operations print to on the calling thread, when it
+ * is capturing them rather than printing to standard output.
  */
-enum Command {
-  CHAR,
-  CIRCLE,
-  CLEAR,
-  DISPLAY,
-  END,
-  GRID,
-  INVALID,
-  LINE,
-  POINT,
-  RECTANGLE
+__thread FILE *output;
+
+/*
+ * The stream operations print to.
+ *
+ * @return The calling thread's output stream.
+ */
+FILE *out(void) {
+  return output ? output : stdout;
+}
+
+/*
+ * The parts of the interpreter whose memory is accounted for.
+ */
+enum MemoryKind {
+  MEMORY_CANVAS,
+  MEMORY_OPERATIONS,
+  MEMORY_PARSER,
+  MEMORY_CACHES,
+  MEMORY_KINDS
 };
 
+const char *MEMORY_NAMES[MEMORY_KINDS] = { "canvas", "operations", "parser", "caches" };
+
 /*
- * A struct array that corresponds a `Command`
- * enum with a string.
+ * The bytes a part of the interpreter holds now and the most it
+ * ever held at once.
  */
-const static struct {
-  enum Command command;
-  const char *str;
-} COMMAND_STRING [] = {
-  { CHAR,      "CHAR"      },
-  { CIRCLE,    "CIRCLE"    },
-  { CLEAR,     "CLEAR"     },
-  { DISPLAY,   "DISPLAY"   },
-  { END,       "END"       },
-  { GRID,      "GRID"      },
-  { LINE,      "LINE"      },
-  { POINT,     "POINT"     },
-  { RECTANGLE, "RECTANGLE" }
+struct MemoryUse {
+  atomic_long current;
+  atomic_long peak;
 };
 
+struct MemoryUse memory_use[MEMORY_KINDS];
+
 /*
- * Find a corresponding `Command` enum from a specified string.
+ * Account for memory taken or given back by a part of the
+ * interpreter.
  *
- * @param str The string to associate with a `Command` enum.
- * @return The correspoding `Command` enum.
+ * @param kind The part.
+ * @param bytes The bytes taken, or negative for bytes given back.
  */
-enum Command command_from_string(char *str) {
-  int size = (
-    sizeof(COMMAND_STRING) /
-    sizeof(COMMAND_STRING[0])
-  );
-
-  for (int i = 0; i < strlen(str); ++i)
-    str[i] = toupper(str[i]);
+void memory_add(enum MemoryKind kind, long bytes) {
+  struct MemoryUse *m = &memory_use[kind];
 
-  for (int i = 0; i < size; ++i)
-    if (!strcmp(str, COMMAND_STRING[i].str))
-      return COMMAND_STRING[i].command;
+  long current = atomic_fetch_add_explicit(&m->current, bytes, memory_order_relaxed) + bytes;
+  long peak = atomic_load_explicit(&m->peak, memory_order_relaxed);
 
-  return INVALID;
+  while (current > peak && !atomic_compare_exchange_weak(&m->peak, &peak, current));
 }
 
 /*
- * Represents an `operation`, which is essentially a command
- * that contains its arguments and its original name.
+ * Block sizes of the slab allocator, powers of two from
+ * 2^SLAB_MIN_SHIFT to 2^SLAB_MAX_SHIFT bytes. Larger requests
+ * go straight to `malloc`.
  */
-struct Operation {
-  char* name;
-  enum Command cmd;
-  int args[ARGS_MAX];
+#define SLAB_MIN_SHIFT 4
+#define SLAB_MAX_SHIFT 16
+#define SLAB_CLASSES (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+
+/*
+ * The size of the slabs blocks are carved from.
+ */
+#define SLAB_SIZE (256 * 1024)
+
+/*
+ * The number of free blocks of each size a thread keeps to
+ * itself, half of them move to or from the shared free list at
+ * a time.
+ */
+#define SLAB_CACHE 32
+
+/*
+ * The number of unmapped canvases of each size kept around for
+ * the next grid.
+ */
+#define CANVAS_CACHE 4
+
+/*
+ * A free block, linked through its first bytes.
+ */
+struct FreeBlock {
+  struct FreeBlock *next;
 };
 
 /*
- * The canvas the user can draw on, holds all
- * relevant state on itself.
+ * The blocks of one size shared by every thread.
+ *
+ * `carve` is what is left of the newest slab. Hits and misses
+ * of thread caches are added in whenever a thread refills.
  */
-struct Grid {
-  char **state;
-  char character;
-  int width;
-  int height;
-  int initialized;
+struct SlabClass {
+  atomic_flag lock;
+  struct FreeBlock *free;
+  char *carve;
+  size_t left;
+  atomic_ulong hits;
+  atomic_ulong misses;
 };
 
 /*
- * A helper to check if a point (`x`, `y`) is in bounds of
- * the drawing area.
+ * A thread's own free blocks of one size.
+ */
+struct SlabCache {
+  struct FreeBlock *free;
+  int count;
+  unsigned long hits;
+};
+
+/*
+ * Canvas mappings waiting to be reused, by the power of two
+ * their length was rounded up to.
+ */
+struct CanvasPool {
+  atomic_flag lock;
+  void *maps[64][CANVAS_CACHE];
+  int counts[64];
+  unsigned long hits;
+  unsigned long misses;
+};
+
+struct SlabClass slab_classes[SLAB_CLASSES];
+
+__thread struct SlabCache slab_cache[SLAB_CLASSES];
+
+atomic_ulong slab_slabs, slab_large;
+
+struct CanvasPool canvas_pool;
+
+/*
+ * Find the size class of a block.
  *
- * @param grid A grid struct
- * @param x The x coordinate
- * @param y The y coordinate
- * @return Whether or not the point (`x`, `y`) is in bounds.
+ * @param size The size of the block.
+ * @return The size class, or -1 if it's too large for one.
  */
-int in_bounds(struct Grid grid, int x, int y) {
-  return (
-    x >= 0 &&
-    x < grid.width &&
-    y >= 0 &&
-    y < grid.height
-  );
+int slab_class(size_t size) {
+  int k = 0;
+
+  while (k < SLAB_CLASSES && ((size_t)1 << (k + SLAB_MIN_SHIFT)) < size)
+    ++k;
+
+  return k < SLAB_CLASSES ? k : -1;
 }
 
 /*
- * A helper to plot a single point on the passed in grid.
+ * Take a spin lock.
  *
- * @param grid A pointer to a grid
- * @param x The x coordinate.
- * @param y The y coordinate.
+ * @param lock A pointer to the lock.
  */
-void plot(struct Grid *grid, int x, int y) {
-  if (!in_bounds(*grid, x, y)) return;
-  grid->state[x][y] = grid->character;
+void spin_lock(atomic_flag *lock) {
+  while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire))
+    sched_yield();
 }
 
 /*
- * Bresenham's line drawing algorithm.
+ * Release a spin lock.
  *
- * Details for understanding can be found here:
- * https://en.wikipedia.org/wiki/Bresenham's_line_algorithm
- *
- * @param grid A pointer to a grid.
- * @param x1
- * @param y1
- * @param x2
- * @param y2
- * @param dx The difference in x values.
- * @param dy The difference in y values.
+ * @param lock A pointer to the lock.
  */
-void bresenham_line(
-  struct Grid *grid,
-  int x1,
-  int y1,
-  int x2,
-  int y2,
-  int dx,
-  int dy,
-  bool decide
-) {
-  int pk = 2 * dy - dx;
-
-  for (int i = 0; i <= dx; ++i) {
-    x1 < x2 ? ++x1 : --x1;
-
-    if (pk < 0) {
-      decide ? plot(grid, y1, x1) : plot(grid, x1, y1);
-      pk = pk + 2 * dy;
-    } else {
-      y1 < y2 ? ++y1 : --y1;
-      decide ? plot(grid, y1, x1) : plot(grid, x1, y1);
-      pk = pk + 2 * dy - 2 * dx;
-    }
-  }
+void spin_unlock(atomic_flag *lock) {
+  atomic_flag_clear_explicit(lock, memory_order_release);
 }
 
 /*
- * Bresenham's circle drawing algorithm.
- *
- * Details for understanding can be found here:
- * https://www.javatpoint.com/computer-graphics-bresenhams-circle-algorithm
+ * Refill a thread's cache of a size class from the shared free
+ * list, carving new blocks once that runs out.
  *
- * @param grid A pointer to a grid.
- * @param xc The center x coordinate.
- * @param yc The center y coordinate.
- * @param radius The circle radius.
+ * @param k The size class.
+ * @return Whether or not the cache has a block now, which it may
+ *         not when no new slab could be allocated.
  */
-void bresenham_circle(
-  struct Grid *grid,
-  int xc,
-  int yc,
-  int radius
-) {
-  int x = 0, y = radius, d = 3 - 2 * radius;
+int slab_refill(int k) {
+  struct SlabClass *c = &slab_classes[k];
+  struct SlabCache *cache = &slab_cache[k];
 
-  plot(grid, xc + x, yc + y);
-  plot(grid, xc + x, yc - y);
-  plot(grid, xc + y, yc + x);
-  plot(grid, xc + y, yc - x);
-  plot(grid, xc - x, yc + y);
-  plot(grid, xc - x, yc - y);
-  plot(grid, xc - y, yc + x);
-  plot(grid, xc - y, yc - x);
+  size_t size = (size_t)1 << (k + SLAB_MIN_SHIFT);
 
-  while (y >= x) {
-    ++x;
+  spin_lock(&c->lock);
 
-    if (d > 0) {
-      y--;
-      d = d + 4 * (x - y) + 10;
+  while (cache->count < SLAB_CACHE / 2) {
+    struct FreeBlock *b = c->free;
+
+    if (b) {
+      c->free = b->next;
     } else {
-      d = d + 4 * x + 6;
+      if (c->left < size) {
+        char *slab = (char*)malloc(SLAB_SIZE);
+
+        if (!slab) break;
+
+        c->carve = slab;
+        c->left = SLAB_SIZE;
+        atomic_fetch_add_explicit(&slab_slabs, 1, memory_order_relaxed);
+      }
+
+      b = (struct FreeBlock*)c->carve;
+      c->carve += size;
+      c->left -= size;
     }
 
-    plot(grid, xc + x, yc + y);
-    plot(grid, xc + x, yc - y);
-    plot(grid, xc + y, yc + x);
-    plot(grid, xc + y, yc - x);
-    plot(grid, xc - x, yc + y);
-    plot(grid, xc - x, yc - y);
-    plot(grid, xc - y, yc + x);
-    plot(grid, xc - y, yc - x);
+    b->next = cache->free;
+    cache->free = b;
+    ++cache->count;
   }
-}
 
-/*
- * Handler for the `CHAR` operation.
- *
- * @param grid A pointer to a grid.
- * @param args [character, ..].
- */
-void character(struct Grid *grid, int args[]) {
-  grid->character = (char)args[0];
+  spin_unlock(&c->lock);
+
+  atomic_fetch_add_explicit(&c->hits, cache->hits, memory_order_relaxed);
+  atomic_fetch_add_explicit(&c->misses, 1, memory_order_relaxed);
+
+  cache->hits = 0;
+
+  return cache->free != NULL;
 }
 
 /*
- * Handler for the `CIRCLE` operation.
+ * Allocate a block from the calling thread's cache of its size.
  *
- * @param grid A pointer to a grid
- * @param args [x, y, radius, ..].
+ * @param size The size of the block.
+ * @return The block, which must be freed with `slab_free` and
+ *         the same size, or `NULL` if memory ran out.
  */
-void circle(struct Grid *grid, int args[]) {
-  int x = args[0], y = args[1], radius = args[2];
+void *slab_alloc(size_t size) {
+  int k = slab_class(size);
 
-  if (!grid->initialized) {
-    printf("error: Grid isn't initialized\n");
-    return;
+  if (k < 0) {
+    atomic_fetch_add_explicit(&slab_large, 1, memory_order_relaxed);
+    return malloc(size);
   }
 
-  bresenham_circle(grid, x, y, radius);
+  struct SlabCache *cache = &slab_cache[k];
+
+  if (cache->free)
+    ++cache->hits;
+  else if (!slab_refill(k))
+    return NULL;
+
+  struct FreeBlock *b = cache->free;
+
+  cache->free = b->next;
+  --cache->count;
+
+  return b;
 }
 
 /*
- * Handler for the `CLEAR` operation.
+ * Allocate a zeroed block.
  *
- * @param grid A pointer to a grid
+ * @param size The size of the block.
+ * @return The block, or `NULL` if memory ran out.
  */
-void clear(struct Grid *grid) {
-  for (int i = 0; i < grid->height; ++i)
-    for (int j = 0; j < grid->width; ++j)
-      grid->state[i][j] = ' ';
+void *slab_calloc(size_t size) {
+  void *p = slab_alloc(size);
+
+  return p ? memset(p, 0, size) : NULL;
 }
 
 /*
- * Handler for the `DISPLAY` operation.
+ * Return a block to the calling thread's cache, handing half of
+ * the cache back to the shared free list when it's full.
  *
- * @param grid A grid struct.
+ * @param p The block, or `NULL`.
+ * @param size The size it was allocated with.
  */
-void display(struct Grid grid) {
-  int wrap = 10;
+void slab_free(void *p, size_t size) {
+  int k = slab_class(size);
 
-  if (!grid.initialized) {
-    printf("error: Grid isn't initialized\n");
+  if (!p) return;
+
+  if (k < 0) {
+    free(p);
     return;
   }
 
-  for (int i = grid.height - 1; i >= 0; --i) {
-    printf("%d ", ((i - wrap) % wrap + wrap) % wrap);
-    for (int j = 0; j < grid.width; ++j)
-      printf("%c", grid.state[i][j]);
-    printf("\n");
-  }
+  struct SlabCache *cache = &slab_cache[k];
+  struct FreeBlock *b = (struct FreeBlock*)p;
 
-  printf(" ");
+  b->next = cache->free;
+  cache->free = b;
 
-  for (int i = 0; i < grid.width; ++i)
-    printf("%d", ((i - wrap) % wrap + wrap) % wrap);
+  if (++cache->count <= SLAB_CACHE) return;
 
-  printf("\n");
+  struct SlabClass *c = &slab_classes[k];
+
+  spin_lock(&c->lock);
+
+  while (cache->count > SLAB_CACHE / 2) {
+    b = cache->free;
+    cache->free = b->next;
+    b->next = c->free;
+    c->free = b;
+    --cache->count;
+  }
+
+  spin_unlock(&c->lock);
 }
 
 /*
- * Handler for the `GRID` operation.
+ * Resize a block, keeping it where it is when the size class
+ * doesn't change.
  *
- * @param grid A pointer to a grid.
- * @param args [width, height, ..].
+ * @param p The block, or `NULL`.
+ * @param old The size it was allocated with.
+ * @param size The new size.
+ * @return The resized block, or `NULL` if memory ran out, in
+ *         which case `p` is left as it was.
  */
-void grid(struct Grid *grid, int args[]) {
-  int width = args[0], height = args[1];
+void *slab_realloc(void *p, size_t old, size_t size) {
+  int k = slab_class(size);
 
-  if (grid->initialized) {
-    printf("error: Grid has already been initialized\n");
-    return;
-  }
+  if (p && k >= 0 && k == slab_class(old)) return p;
+  if (p && k < 0 && slab_class(old) < 0) return realloc(p, size);
 
-  grid->state = (char**)malloc(sizeof(char*)*width);
+  void *q = slab_alloc(size);
 
-  for (int i = 0; i < height; ++i)
-    grid->state[i] = (char*)malloc(sizeof(char)*height);
+  if (!q) return NULL;
 
-  for (int i = 0; i < height; ++i)
-    for (int j = 0; j < width; ++j)
-      grid->state[i][j] = ' ';
+  if (p) memcpy(q, p, old < size ? old : size);
 
-  grid->width = width;
-  grid->height = height;
-  grid->initialized = 1;
+  slab_free(p, old);
+
+  return q;
 }
 
 /*
- * Handler for the `LINE` operation.
- *
- * @param grid A pointer to a grid.
- * @param args [x1, y1, x2, y2].
+ * Hand a thread's cached blocks back before it exits.
  */
-void line(struct Grid *grid, int args[]) {
-  int x1 = args[0], y1 = args[1], x2 = args[2], y2 = args[3];
+void slab_release(void) {
+  for (int k = 0; k < SLAB_CLASSES; ++k) {
+    struct SlabCache *cache = &slab_cache[k];
+    struct SlabClass *c = &slab_classes[k];
 
-  if (!grid->initialized) {
-    printf("error: Grid isn't initialized\n");
-    return;
-  }
+    spin_lock(&c->lock);
 
-  plot(grid, x1, y1);
+    while (cache->free) {
+      struct FreeBlock *b = cache->free;
+      cache->free = b->next;
+      b->next = c->free;
+      c->free = b;
+    }
 
-  int dx = abs(x2 - x1), dy = abs(y2 - y1);
+    spin_unlock(&c->lock);
 
-  dx > dy ?
-    bresenham_line(grid, x1, y1, x2, y2, dx, dy, false) :
-    bresenham_line(grid, y1, x1, y2, x2, dy, dx, true);
+    atomic_fetch_add_explicit(&c->hits, cache->hits, memory_order_relaxed);
+
+    cache->count = 0;
+    cache->hits = 0;
+  }
 }
 
 /*
- * Handler for the `POINT` operation.
+ * The class of a canvas mapping, the power of two its length is
+ * rounded up to.
  *
- * @param grid A pointer to a grid.
- * @param args [x, y, ..].
+ * @param length The length of the mapping.
+ * @return The class.
  */
-void point(struct Grid *grid, int args[]) {
-  int x = args[0], y = args[1];
+int canvas_class(size_t length) {
+  int k = 0;
 
-  if (!grid->initialized) {
-    printf("error: Grid isn't initialized\n");
-    return;
-  }
+  while (((size_t)1 << k) < length) ++k;
 
-  plot(grid, x, y);
+  return k;
 }
 
 /*
- * Handler for the `RECTANGLE` operation.
+ * Map a canvas of zero pages, reusing one that was unmapped
+ * before when there is one of the same class.
  *
- * @param grid A pointer to a grid.
- * @param args [x1, y1, x2, y2].
+ * @param length The length of the canvas.
+ * @return The canvas, or `MAP_FAILED`.
  */
-void rectangle(struct Grid *grid, int args[]) {
-  int x1 = args[0], y1 = args[1], x2 = args[2], y2 = args[3];
+void *canvas_map(size_t length) {
+  int k = canvas_class(length);
 
-  if (!grid->initialized) {
-    printf("error: Grid isn't initialized\n");
+  void *cells = NULL;
+
+  spin_lock(&canvas_pool.lock);
+
+  if (canvas_pool.counts[k]) {
+    cells = canvas_pool.maps[k][--canvas_pool.counts[k]];
+    ++canvas_pool.hits;
+  } else {
+    ++canvas_pool.misses;
+  }
+
+  spin_unlock(&canvas_pool.lock);
+
+  if (!cells)
+    cells = mmap(
+      NULL,
+      (size_t)1 << k,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+      -1,
+      0
+    );
+
+  if (cells != MAP_FAILED) memory_add(MEMORY_CANVAS, (long)1 << k);
+
+  return cells;
+}
+
+/*
+ * Give a canvas's pages back to the kernel and keep the mapping
+ * around for the next canvas of its class, or unmap it if there
+ * are enough of those already.
+ *
+ * @param cells The canvas.
+ * @param length The length it was mapped with.
+ */
+void canvas_unmap(void *cells, size_t length) {
+  int k = canvas_class(length);
+
+  madvise(cells, (size_t)1 << k, MADV_DONTNEED);
+
+  memory_add(MEMORY_CANVAS, -((long)1 << k));
+
+  spin_lock(&canvas_pool.lock);
+
+  if (canvas_pool.counts[k] < CANVAS_CACHE) {
+    canvas_pool.maps[k][canvas_pool.counts[k]++] = cells;
+    cells = NULL;
+  }
+
+  spin_unlock(&canvas_pool.lock);
+
+  if (cells) munmap(cells, (size_t)1 << k);
+}
+
+/*
+ * Print how well the slabs and the canvas pool are reused.
+ */
+void slab_stats(void) {
+  unsigned long hits = 0, misses = 0;
+
+  for (int k = 0; k < SLAB_CLASSES; ++k) {
+    hits += atomic_load(&slab_classes[k].hits) + slab_cache[k].hits;
+    misses += atomic_load(&slab_classes[k].misses);
+  }
+
+  fprintf(
+    out(),
+    "slabs: %lu hits, %lu misses, %lu large, %lu KB\n",
+    hits,
+    misses,
+    atomic_load(&slab_large),
+    atomic_load(&slab_slabs) * SLAB_SIZE / 1024
+  );
+
+  spin_lock(&canvas_pool.lock);
+
+  fprintf(out(), "canvases: %lu hits, %lu misses\n", canvas_pool.hits, canvas_pool.misses);
+
+  spin_unlock(&canvas_pool.lock);
+}
+
+/*
+ * Print what each part of the interpreter holds, how fragmented
+ * the heap and the slabs are and how much of it all is resident.
+ */
+void memory_stats(void) {
+  long total = 0;
+
+  for (int k = 0; k < MEMORY_KINDS; ++k) {
+    long current = atomic_load(&memory_use[k].current);
+
+    total += current;
+
+    fprintf(
+      out(),
+      "%s: %ld KB (peak %ld KB)\n",
+      MEMORY_NAMES[k],
+      current / 1024,
+      atomic_load(&memory_use[k].peak) / 1024
+    );
+  }
+
+  fprintf(out(), "total: %ld KB\n", total / 1024);
+
+  struct mallinfo2 heap = mallinfo2();
+
+  fprintf(
+    out(),
+    "heap: %zu KB in use, %zu KB free, %.1f%% fragmented\n",
+    (heap.uordblks + heap.hblkhd) / 1024,
+    heap.fordblks / 1024,
+    heap.arena ? 100.0 * (heap.fordblks - heap.keepcost) / heap.arena : 0.0
+  );
+
+  size_t reserved = atomic_load(&slab_slabs) * SLAB_SIZE, idle = 0, cached = 0, untouched = 0;
+
+  for (int k = 0; k < SLAB_CLASSES; ++k) {
+    struct SlabClass *c = &slab_classes[k];
+
+    size_t size = (size_t)1 << (k + SLAB_MIN_SHIFT);
+
+    spin_lock(&c->lock);
+
+    for (struct FreeBlock *b = c->free; b; b = b->next) idle += size;
+
+    untouched += c->left;
+
+    spin_unlock(&c->lock);
+
+    cached += slab_cache[k].count * size;
+  }
+
+  // Slabs are carved as blocks are needed, the rest was never handed out
+  size_t carved = reserved - untouched;
+
+  // Blocks held in thread caches count as in use, only this thread's are known
+  fprintf(
+    out(),
+    "slab space: %zu KB reserved, %zu KB carved, %zu KB free, %zu KB cached, %.1f%% fragmented\n",
+    reserved / 1024,
+    carved / 1024,
+    idle / 1024,
+    cached / 1024,
+    carved ? 100.0 * idle / carved : 0.0
+  );
+
+  FILE *statm = fopen("/proc/self/statm", "r");
+
+  unsigned long pages = 0;
+
+  if (statm) {
+    if (fscanf(statm, "%*s %lu", &pages) != 1) pages = 0;
+    fclose(statm);
+  }
+
+  fprintf(out(), "resident: %lu KB\n", pages * (unsigned long)sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * All available commands the interpreter
+ * can evaluate.
+ */
+enum Command {
+  CHAR,
+  CIRCLE,
+  CLEAR,
+  DISPLAY,
+  END,
+  GRID,
+  INCLUDE,
+  INVALID,
+  LINE,
+  MEMORY,
+  POINT,
+  RECTANGLE,
+  STATS,
+  VIEW,
+  VIEWER,
+  ZOOM
+};
+
+/*
+ * A struct array that corresponds a `Command`
+ * enum with a string.
+ */
+const static struct {
+  enum Command command;
+  const char *str;
+} COMMAND_STRING [] = {
+  { CHAR,      "CHAR"      },
+  { CIRCLE,    "CIRCLE"    },
+  { CLEAR,     "CLEAR"     },
+  { DISPLAY,   "DISPLAY"   },
+  { END,       "END"       },
+  { GRID,      "GRID"      },
+  { INCLUDE,   "INCLUDE"   },
+  { LINE,      "LINE"      },
+  { MEMORY,    "MEMORY"    },
+  { POINT,     "POINT"     },
+  { RECTANGLE, "RECTANGLE" },
+  { STATS,     "STATS"     },
+  { VIEW,      "VIEW"      },
+  { VIEWER,    "VIEWER"    },
+  { ZOOM,      "ZOOM"      }
+};
+
+/*
+ * Find a corresponding `Command` enum from a specified string,
+ * ignoring case.
+ *
+ * @param str The string to associate with a `Command` enum.
+ * @param n The length of the string.
+ * @return The correspoding `Command` enum.
+ */
+enum Command command_from_string(const char *str, size_t n) {
+  int size = (
+    sizeof(COMMAND_STRING) /
+    sizeof(COMMAND_STRING[0])
+  );
+
+  char upper[16] = { 0 };
+
+  if (n >= sizeof(upper)) return INVALID;
+
+  memcpy(upper, str, n);
+
+#ifdef __SSE2__
+  __m128i v = _mm_loadu_si128((const __m128i*)upper);
+  __m128i lower = _mm_and_si128(
+    _mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)),
+    _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1))
+  );
+  _mm_storeu_si128(
+    (__m128i*)upper,
+    _mm_sub_epi8(v, _mm_and_si128(lower, _mm_set1_epi8('a' - 'A')))
+  );
+#else
+  for (size_t i = 0; i < n; ++i)
+    if (upper[i] >= 'a' && upper[i] <= 'z') upper[i] -= 'a' - 'A';
+#endif
+
+  for (int i = 0; i < size; ++i)
+    if (!strcmp(upper, COMMAND_STRING[i].str))
+      return COMMAND_STRING[i].command;
+
+  return INVALID;
+}
+
+/*
+ * Represents an `operation`, which is essentially a command
+ * that contains its arguments and its original name.
+ */
+struct Operation {
+  char* name;
+  enum Command cmd;
+  int args[ARGS_MAX];
+  char *path;
+  int line;
+};
+
+/*
+ * The number of commands, for tables indexed by them.
+ */
+#define COMMANDS (ZOOM + 1)
+
+/*
+ * The number of latency histogram buckets, the first holding
+ * operations that took up to a microsecond and every next one
+ * ten times as long, the last everything slower.
+ */
+#define LATENCY_BUCKETS 8
+
+/*
+ * The queues whose depth is tracked.
+ */
+enum QueueKind { QUEUE_DISPLAY_LIST, QUEUE_SESSION, QUEUE_SUBSCRIBERS, QUEUES };
+
+/*
+ * A thread's counters, which only that thread writes to and any
+ * thread may read.
+ *
+ * Blocks are never freed, a thread that exits gives its block up
+ * for the next thread to keep counting in. Queue depths are what
+ * was ever added to a queue less what was ever taken off of it.
+ */
+struct Counters {
+  atomic_int owned;
+  atomic_ulong ops[COMMANDS];
+  atomic_ulong latency[COMMANDS][LATENCY_BUCKETS];
+  atomic_ulong latency_ns[COMMANDS];
+  atomic_ulong cells;
+  atomic_ulong frames;
+  atomic_ulong bytes;
+  atomic_ulong enqueued[QUEUES];
+  atomic_ulong dequeued[QUEUES];
+  struct Counters *next;
+};
+
+_Atomic(struct Counters*) counters_list;
+
+__thread struct Counters *counters_mine;
+
+pthread_key_t counters_key;
+
+pthread_once_t counters_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Give up a thread's counters when it exits.
+ *
+ * @param c A pointer to the counters.
+ */
+void counters_leave(void *c) {
+  atomic_store(&((struct Counters*)c)->owned, 0);
+}
+
+/*
+ * Create the key that gives up counters on thread exit.
+ */
+void counters_key_init(void) {
+  pthread_key_create(&counters_key, counters_leave);
+}
+
+/*
+ * The calling thread's counters, taking over a block some exited
+ * thread gave up or adding a new one on first use.
+ *
+ * @return A pointer to the counters.
+ */
+struct Counters *counters(void) {
+  if (counters_mine) return counters_mine;
+
+  struct Counters *c = atomic_load(&counters_list);
+
+  for (; c; c = c->next) {
+    int expected = 0;
+
+    if (atomic_compare_exchange_strong(&c->owned, &expected, 1)) break;
+  }
+
+  if (!c) {
+    c = (struct Counters*)calloc(1, sizeof(struct Counters));
+    atomic_init(&c->owned, 1);
+    c->next = atomic_load(&counters_list);
+
+    while (!atomic_compare_exchange_weak(&counters_list, &c->next, c));
+  }
+
+  pthread_once(&counters_once, counters_key_init);
+  pthread_setspecific(counters_key, c);
+
+  return counters_mine = c;
+}
+
+/*
+ * Add to one of the calling thread's counters. Nobody else
+ * writes to it, so this is a plain load and store.
+ *
+ * @param counter A pointer to the counter.
+ * @param n The amount to add.
+ */
+void count(atomic_ulong *counter, unsigned long n) {
+  atomic_store_explicit(
+    counter,
+    atomic_load_explicit(counter, memory_order_relaxed) + n,
+    memory_order_relaxed
+  );
+}
+
+/*
+ * The current time in seconds.
+ *
+ * @return The time.
+ */
+double now(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+ * Record how long an operation took.
+ *
+ * @param cmd The command.
+ * @param seconds How long it took.
+ */
+void observe(enum Command cmd, double seconds) {
+  struct Counters *c = counters();
+
+  int k = 0;
+
+  for (double bound = 1e-6; k < LATENCY_BUCKETS - 1 && seconds > bound; bound *= 10)
+    ++k;
+
+  count(&c->ops[cmd], 1);
+  count(&c->latency[cmd][k], 1);
+  count(&c->latency_ns[cmd], (unsigned long)(seconds * 1e9));
+}
+
+/*
+ * A fixed set of worker threads that all run the same task
+ * together, each pinned to its own CPU.
+ *
+ * Workers are numbered so that consecutive workers sit on the
+ * same NUMA node whenever possible, letting callers hand out
+ * contiguous work to workers sharing memory. A pool without
+ * threads runs tasks on the calling thread as worker 0.
+ */
+struct Pool {
+  pthread_t *threads;
+  int *cpus;
+  int size;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t idle;
+  unsigned long generation;
+  int running;
+  void (*task)(void *ctx, int worker);
+  void *ctx;
+};
+
+/*
+ * The startup argument of a pool worker thread.
+ */
+struct Worker {
+  struct Pool *pool;
+  int id;
+};
+
+/*
+ * Find the NUMA node a CPU belongs to.
+ *
+ * @param cpu The CPU number.
+ * @return The node number, or 0 if it can't be determined.
+ */
+int cpu_node(int cpu) {
+  char path[64];
+
+  for (int node = 0; node < 64; ++node) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpu%d", node, cpu);
+    if (!access(path, F_OK)) return node;
+  }
+
+  return 0;
+}
+
+/*
+ * The body of a pool worker thread.
+ *
+ * @param arg A pointer to a worker struct.
+ */
+void *pool_worker(void *arg) {
+  struct Worker *worker = (struct Worker*)arg;
+  struct Pool *pool = worker->pool;
+
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(pool->cpus[worker->id], &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+  unsigned long seen = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->generation == seen)
+      pthread_cond_wait(&pool->wake, &pool->lock);
+
+    seen = pool->generation;
+
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->task(pool->ctx, worker->id);
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (!--pool->running)
+      pthread_cond_signal(&pool->idle);
+
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+/*
+ * Start the workers of a pool.
+ *
+ * CPUs the process may run on are sorted by NUMA node and the
+ * workers are pinned to them in that order.
+ *
+ * @param pool A pointer to a pool.
+ * @param size The number of workers, 1 or less runs everything inline.
+ */
+void pool_init(struct Pool *pool, int size) {
+  pool->size = size > 1 ? size : 0;
+
+  if (!pool->size) return;
+
+  cpu_set_t set;
+
+  int cpus[CPU_SETSIZE], nodes[CPU_SETSIZE], count = 0;
+
+  if (sched_getaffinity(0, sizeof(set), &set)) CPU_ZERO(&set);
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    if (CPU_ISSET(cpu, &set)) {
+      int node = cpu_node(cpu), j = count++;
+
+      for (; j > 0 && nodes[j - 1] > node; --j) {
+        cpus[j] = cpus[j - 1];
+        nodes[j] = nodes[j - 1];
+      }
+
+      cpus[j] = cpu;
+      nodes[j] = node;
+    }
+
+  if (!count) cpus[count++] = 0;
+
+  pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * pool->size);
+  pool->cpus = (int*)malloc(sizeof(int) * pool->size);
+
+  for (int i = 0; i < pool->size; ++i)
+    pool->cpus[i] = cpus[(long)i * count / pool->size];
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+
+  pool->generation = 0;
+
+  struct Worker *workers = (struct Worker*)malloc(sizeof(struct Worker) * pool->size);
+
+  for (int i = 0; i < pool->size; ++i) {
+    workers[i] = (struct Worker) { pool, i };
+    pthread_create(&pool->threads[i], NULL, pool_worker, &workers[i]);
+  }
+}
+
+/*
+ * A helper to find how many workers a pool runs a task on.
+ *
+ * @param pool A pointer to a pool.
+ * @return The number of workers.
+ */
+int pool_workers(struct Pool *pool) {
+  return pool && pool->size ? pool->size : 1;
+}
+
+/*
+ * Run a task on every worker of a pool and wait for all of
+ * them to finish.
+ *
+ * @param pool A pointer to a pool, or `NULL` to run inline.
+ * @param task The task, called with `ctx` and the worker number.
+ * @param ctx The task argument.
+ */
+void pool_run(struct Pool *pool, void (*task)(void *ctx, int worker), void *ctx) {
+  if (!pool || !pool->size) {
+    task(ctx, 0);
     return;
   }
 
-  if (x1 > x2) {
-    int temp = x1;
-    x1 = x2;
-    x2 = temp;
+  pthread_mutex_lock(&pool->lock);
+
+  pool->task = task;
+  pool->ctx = ctx;
+  pool->running = pool->size;
+  ++pool->generation;
+
+  pthread_cond_broadcast(&pool->wake);
+
+  while (pool->running)
+    pthread_cond_wait(&pool->idle, &pool->lock);
+
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * The side length of a square tile, in cells. Tiles are the unit
+ * of dirty tracking used to keep the zoom pyramid up to date.
+ */
+#define TILE_SIZE 64
+
+/*
+ * The maximum number of columns and rows shown by `ZOOM`.
+ */
+#define VIEWPORT_WIDTH 80
+#define VIEWPORT_HEIGHT 24
+
+/*
+ * Characters used to draw reduced cells, ordered from
+ * empty to fully inked.
+ */
+const static char DENSITY[] = " .:-=+*#%@";
+
+/*
+ * A multi-resolution summary of the canvas.
+ *
+ * Level `k` divides the canvas into blocks of `2^k` by `2^k`
+ * cells and stores how many of them are inked. `counts[k - 1]`
+ * holds level `k` in row-major order, level 0 is the canvas
+ * itself.
+ */
+struct Pyramid {
+  unsigned **counts;
+  int levels;
+  int built;
+};
+
+/*
+ * An axis aligned rectangle of cells, both corners inclusive.
+ */
+struct Rect {
+  int x1;
+  int y1;
+  int x2;
+  int y2;
+};
+
+/*
+ * The ways a display list can be rasterized by a pool.
+ */
+enum Render {
+  RENDER_BANDS,
+  RENDER_DAG,
+  RENDER_STAMPS
+};
+
+/*
+ * Bookkeeping for a strip of `TILE_SIZE` rows of the canvas.
+ *
+ * `touched` is the sequence number of the last primitive drawn
+ * into the strip, or 0 while the strip is blank. A cold strip
+ * is kept compressed in `packed` and its pages are handed back.
+ */
+struct Strip {
+  unsigned long touched;
+  unsigned char *packed;
+  size_t packed_size;
+};
+
+/*
+ * The canvas the user can draw on, holds all
+ * relevant state on itself.
+ *
+ * Cells are stored row by row in strips of `TILE_SIZE` rows,
+ * each starting on a page boundary, see `row`. A blank cell
+ * holds 0, so the canvas is mapped from zero pages and only
+ * pages that get drawn on are ever committed. Every strip
+ * belongs to the pool worker whose band contains it, and that
+ * worker is the only one to touch it.
+ *
+ * When `cold` is set, strips not drawn on for that many
+ * primitives are compressed, see `freeze`. Cells must be thawed
+ * before they are read or written.
+ *
+ * While `stamps` is set, plotting records (`seq`, `character`)
+ * in it for the cells of `stamped` instead of writing cells.
+ *
+ * The rasterizers add the cells they plot inside of `clip` to
+ * `plotted`, which `draw` reports.
+ */
+struct Grid {
+  char *cells;
+  size_t stride;
+  struct Strip *strips;
+  unsigned long cold;
+  char character;
+  int width;
+  int height;
+  int initialized;
+  struct Rect clip;
+  unsigned long version;
+  char *dirty;
+  int tiles_x;
+  int tiles_y;
+  struct Pyramid pyramid;
+  struct Pool *pool;
+  enum Render render;
+  _Atomic uint64_t *stamps;
+  struct Rect stamped;
+  unsigned long seq;
+  unsigned long plotted;
+};
+
+/*
+ * A helper to check if a point (`x`, `y`) is in bounds of
+ * the drawing area.
+ *
+ * @param grid A grid struct
+ * @param x The x coordinate
+ * @param y The y coordinate
+ * @return Whether or not the point (`x`, `y`) is in bounds.
+ */
+int in_bounds(struct Grid grid, int x, int y) {
+  return (
+    x >= 0 &&
+    x < grid.width &&
+    y >= 0 &&
+    y < grid.height
+  );
+}
+
+/*
+ * A helper to check if a point (`x`, `y`) lies in a rectangle.
+ *
+ * @param r A rect struct.
+ * @param x The x coordinate.
+ * @param y The y coordinate.
+ * @return Whether or not the point (`x`, `y`) is in `r`.
+ */
+int in_rect(struct Rect r, int x, int y) {
+  return (
+    x >= r.x1 &&
+    x <= r.x2 &&
+    y >= r.y1 &&
+    y <= r.y2
+  );
+}
+
+/*
+ * A helper to check if two rectangles share at least one cell.
+ *
+ * @param a A rect struct.
+ * @param b A rect struct.
+ * @return Whether or not `a` and `b` overlap.
+ */
+int intersects(struct Rect a, struct Rect b) {
+  return (
+    a.x1 <= b.x2 &&
+    b.x1 <= a.x2 &&
+    a.y1 <= b.y2 &&
+    b.y1 <= a.y2
+  );
+}
+
+/*
+ * A helper to find the first cell of a row.
+ *
+ * @param grid A pointer to a grid.
+ * @param y The row.
+ * @return A pointer to the cell at (0, `y`).
+ */
+char *row(struct Grid *grid, int y) {
+  return (
+    grid->cells +
+    (size_t)(y / TILE_SIZE) * grid->stride +
+    (size_t)(y % TILE_SIZE) * grid->width
+  );
+}
+
+/*
+ * A helper to plot a single point on the passed in grid.
+ *
+ * Points outside of the grid's clipping rectangle are
+ * silently dropped.
+ *
+ * @param grid A pointer to a grid
+ * @param x The x coordinate.
+ * @param y The y coordinate.
+ */
+void plot(struct Grid *grid, int x, int y) {
+  if (!in_rect(grid->clip, x, y)) return;
+
+  if (!grid->stamps) {
+    row(grid, y)[x] = grid->character;
+    return;
+  }
+
+  struct Rect s = grid->stamped;
+
+  _Atomic uint64_t *cell =
+    &grid->stamps[(size_t)(y - s.y1) * (s.x2 - s.x1 + 1) + x - s.x1];
+
+  uint64_t stamp = (uint64_t)grid->seq << 8 | (unsigned char)grid->character,
+           old = atomic_load_explicit(cell, memory_order_relaxed);
+
+  while (
+    old < stamp &&
+    !atomic_compare_exchange_weak_explicit(
+      cell,
+      &old,
+      stamp,
+      memory_order_relaxed,
+      memory_order_relaxed
+    )
+  );
+}
+
+/*
+ * Mark every tile overlapping a rectangle as dirty.
+ *
+ * @param grid A pointer to a grid.
+ * @param r The rectangle, which must lie within the grid.
+ */
+void mark_dirty(struct Grid *grid, struct Rect r) {
+  if (!intersects(r, (struct Rect) { 0, 0, grid->width - 1, grid->height - 1 }))
+    return;
+
+  if (r.x1 < 0) r.x1 = 0;
+  if (r.y1 < 0) r.y1 = 0;
+  if (r.x2 >= grid->width) r.x2 = grid->width - 1;
+  if (r.y2 >= grid->height) r.y2 = grid->height - 1;
+
+  ++grid->version;
+
+  for (int ty = r.y1 / TILE_SIZE; ty <= r.y2 / TILE_SIZE; ++ty)
+    for (int tx = r.x1 / TILE_SIZE; tx <= r.x2 / TILE_SIZE; ++tx)
+      grid->dirty[ty * grid->tiles_x + tx] = 1;
+}
+
+/*
+ * Find the band of rows owned by a pool worker.
+ *
+ * Bands are made of whole strips, handed out in order so that
+ * neighbouring bands go to workers on the same node.
+ *
+ * @param grid A pointer to a grid.
+ * @param worker The worker number.
+ * @return The band, empty when `y1 > y2`.
+ */
+struct Rect band(struct Grid *grid, int worker) {
+  int workers = pool_workers(grid->pool),
+      strips = (grid->height + TILE_SIZE - 1) / TILE_SIZE,
+      y1 = (int)((long)worker * strips / workers) * TILE_SIZE,
+      y2 = (int)((long)(worker + 1) * strips / workers) * TILE_SIZE;
+
+  return (struct Rect) {
+    0,
+    y1,
+    grid->width - 1,
+    (y2 < grid->height ? y2 : grid->height) - 1
+  };
+}
+
+/*
+ * A helper to check if a cell holds ink.
+ *
+ * @param c The cell contents.
+ * @return Whether or not the cell is drawn on.
+ */
+int inked(char c) {
+  return c && c != ' ';
+}
+
+/*
+ * A helper to find the width or height of the canvas at a
+ * pyramid level.
+ *
+ * @param size The width or height at level 0.
+ * @param level The pyramid level.
+ * @return The number of blocks along that axis.
+ */
+int level_size(int size, int level) {
+  return (size + (1 << level) - 1) >> level;
+}
+
+/*
+ * Compress bytes with PackBits run length encoding.
+ *
+ * A control byte below 128 is followed by that many plus one
+ * literal bytes, any other is followed by a single byte repeated
+ * the control byte minus 125 times.
+ *
+ * @param dst The destination, at least `n + n / 128 + 1` bytes.
+ * @param src The bytes to compress.
+ * @param n The number of bytes.
+ * @return The compressed size.
+ */
+size_t pack(unsigned char *dst, const unsigned char *src, size_t n) {
+  size_t i = 0, o = 0;
+
+  while (i < n) {
+    size_t run = 1;
+
+    while (i + run < n && run < 130 && src[i + run] == src[i])
+      ++run;
+
+    if (run >= 3) {
+      dst[o++] = (unsigned char)(run + 125);
+      dst[o++] = src[i];
+      i += run;
+      continue;
+    }
+
+    size_t start = i;
+
+    while (
+      i < n &&
+      i - start < 128 &&
+      !(i + 2 < n && src[i] == src[i + 1] && src[i] == src[i + 2])
+    ) ++i;
+
+    dst[o++] = (unsigned char)(i - start - 1);
+    memcpy(dst + o, src + start, i - start);
+    o += i - start;
+  }
+
+  return o;
+}
+
+/*
+ * Decompress bytes compressed by `pack` into zeroed memory.
+ *
+ * Runs of zeros are skipped rather than written, so pages that
+ * only hold blank cells are never touched.
+ *
+ * @param dst The destination, which must be zeroed.
+ * @param src The compressed bytes.
+ * @param n The number of compressed bytes.
+ */
+void unpack(unsigned char *dst, const unsigned char *src, size_t n) {
+  for (size_t i = 0; i < n;) {
+    unsigned char c = src[i++];
+
+    if (c < 128) {
+      memcpy(dst, src + i, c + 1);
+      dst += c + 1;
+      i += c + 1;
+    } else {
+      if (src[i]) memset(dst, src[i], c - 125);
+      dst += c - 125;
+      ++i;
+    }
+  }
+}
+
+/*
+ * A helper to find the number of cells a strip holds.
+ *
+ * @param grid A pointer to a grid.
+ * @param strip The strip index.
+ * @return The number of cells.
+ */
+size_t strip_cells(struct Grid *grid, int strip) {
+  int rows = grid->height - strip * TILE_SIZE;
+  return (size_t)(rows < TILE_SIZE ? rows : TILE_SIZE) * grid->width;
+}
+
+/*
+ * Make sure the strips holding some rows are uncompressed.
+ *
+ * @param grid A pointer to a grid.
+ * @param y1 The first row.
+ * @param y2 The last row.
+ */
+void thaw(struct Grid *grid, int y1, int y2) {
+  if (y1 < 0) y1 = 0;
+  if (y2 >= grid->height) y2 = grid->height - 1;
+
+  for (int s = y1 / TILE_SIZE; y1 <= y2 && s <= y2 / TILE_SIZE; ++s) {
+    struct Strip *strip = &grid->strips[s];
+
+    if (!strip->packed) continue;
+
+    unpack((unsigned char*)row(grid, s * TILE_SIZE), strip->packed, strip->packed_size);
+
+    memory_add(MEMORY_CANVAS, -(long)strip->packed_size);
+    slab_free(strip->packed, strip->packed_size);
+    strip->packed = NULL;
+  }
+}
+
+/*
+ * Make sure the strips under a rectangle are uncompressed and
+ * record that they are being drawn on.
+ *
+ * @param grid A pointer to a grid.
+ * @param r The rectangle.
+ * @param seq The sequence number of the primitive drawing there.
+ */
+void touch(struct Grid *grid, struct Rect r, unsigned long seq) {
+  if (r.y1 < 0) r.y1 = 0;
+  if (r.y2 >= grid->height) r.y2 = grid->height - 1;
+
+  if (r.y1 > r.y2 || r.x2 < 0 || r.x1 >= grid->width) return;
+
+  thaw(grid, r.y1, r.y2);
+
+  for (int s = r.y1 / TILE_SIZE; s <= r.y2 / TILE_SIZE; ++s)
+    grid->strips[s].touched = seq;
+}
+
+/*
+ * Compress every strip that hasn't been drawn on for `cold`
+ * primitives and hand its pages back to the kernel.
+ *
+ * Strips that don't shrink to at most half of their size are
+ * treated as freshly drawn on, so they aren't tried again for
+ * another `cold` primitives.
+ *
+ * @param grid A pointer to a grid.
+ * @param seq The sequence number of the latest primitive.
+ */
+void freeze(struct Grid *grid, unsigned long seq) {
+  if (!grid->initialized || !grid->cold) return;
+
+  unsigned char *buffer = NULL;
+
+  for (int s = 0; s < (grid->height + TILE_SIZE - 1) / TILE_SIZE; ++s) {
+    struct Strip *strip = &grid->strips[s];
+
+    if (strip->packed || !strip->touched || strip->touched + grid->cold > seq)
+      continue;
+
+    size_t n = strip_cells(grid, s);
+
+    if (!buffer) buffer = (unsigned char*)malloc(grid->stride + grid->stride / 128 + 1);
+
+    size_t size = pack(buffer, (unsigned char*)row(grid, s * TILE_SIZE), n);
+
+    if (size > n / 2) {
+      strip->touched = seq;
+      continue;
+    }
+
+    if (!(strip->packed = (unsigned char*)slab_alloc(size))) {
+      strip->touched = seq;
+      continue;
+    }
+
+    strip->packed_size = size;
+
+    memory_add(MEMORY_CANVAS, size);
+
+    memcpy(strip->packed, buffer, size);
+    madvise(row(grid, s * TILE_SIZE), grid->stride, MADV_DONTNEED);
+  }
+
+  free(buffer);
+}
+
+/*
+ * Recompute a single block of the zoom pyramid from the
+ * level below it.
+ *
+ * @param grid A pointer to a grid.
+ * @param level The level of the block, at least 1.
+ * @param bx The block column.
+ * @param by The block row.
+ */
+void pyramid_block(struct Grid *grid, int level, int bx, int by) {
+  struct Pyramid *p = &grid->pyramid;
+
+  unsigned count = 0;
+
+  if (level == 1 && !grid->strips[by * 2 / TILE_SIZE].touched) {
+    count = 0;
+  } else if (level == 1) {
+    thaw(grid, by * 2, by * 2 + 1);
+
+    for (int y = by * 2; y < by * 2 + 2 && y < grid->height; ++y)
+      for (int x = bx * 2; x < bx * 2 + 2 && x < grid->width; ++x)
+        count += inked(row(grid, y)[x]);
+  } else {
+    unsigned *below = p->counts[level - 2];
+
+    int w = level_size(grid->width, level - 1),
+        h = level_size(grid->height, level - 1);
+
+    for (int y = by * 2; y < by * 2 + 2 && y < h; ++y)
+      for (int x = bx * 2; x < bx * 2 + 2 && x < w; ++x)
+        count += below[y * w + x];
+  }
+
+  p->counts[level - 1][by * level_size(grid->width, level) + bx] = count;
+}
+
+/*
+ * The size of the zoom pyramid of a grid, built or not.
+ *
+ * @param grid A pointer to a grid.
+ * @return The size in bytes.
+ */
+long pyramid_bytes(struct Grid *grid) {
+  long bytes = sizeof(unsigned*) * (grid->pyramid.levels + 1);
+
+  for (int k = 1; k <= grid->pyramid.levels; ++k)
+    bytes += (long)level_size(grid->width, k) * level_size(grid->height, k) * sizeof(unsigned);
+
+  return bytes;
+}
+
+/*
+ * Bring the zoom pyramid up to date with the canvas.
+ *
+ * The pyramid is allocated the first time it is needed, after
+ * that only blocks covering tiles drawn on since the last
+ * update are recomputed, one level at a time from the bottom.
+ *
+ * @param grid A pointer to a grid.
+ */
+void pyramid_update(struct Grid *grid) {
+  struct Pyramid *p = &grid->pyramid;
+
+  if (!p->built) {
+    int size = grid->width > grid->height ? grid->width : grid->height;
+
+    p->levels = 0;
+
+    while ((1 << p->levels) < size)
+      ++p->levels;
+
+    p->counts = (unsigned**)malloc(sizeof(unsigned*) * (p->levels + 1));
+
+    for (int k = 1; k <= p->levels; ++k)
+      p->counts[k - 1] = (unsigned*)calloc(
+        (size_t)level_size(grid->width, k) * level_size(grid->height, k),
+        sizeof(unsigned)
+      );
+
+    memory_add(MEMORY_CACHES, pyramid_bytes(grid));
+
+    memset(grid->dirty, 1, grid->tiles_x * grid->tiles_y);
+
+    p->built = 1;
+  }
+
+  for (int k = 1; k <= p->levels; ++k)
+    for (int ty = 0; ty < grid->tiles_y; ++ty)
+      for (int tx = 0; tx < grid->tiles_x; ++tx) {
+        if (!grid->dirty[ty * grid->tiles_x + tx]) continue;
+
+        int x1 = tx * TILE_SIZE, y1 = ty * TILE_SIZE;
+
+        int x2 = x1 + TILE_SIZE < grid->width ? x1 + TILE_SIZE : grid->width,
+            y2 = y1 + TILE_SIZE < grid->height ? y1 + TILE_SIZE : grid->height;
+
+        for (int by = y1 >> k; by <= (y2 - 1) >> k; ++by)
+          for (int bx = x1 >> k; bx <= (x2 - 1) >> k; ++bx)
+            pyramid_block(grid, k, bx, by);
+      }
+
+  memset(grid->dirty, 0, grid->tiles_x * grid->tiles_y);
+}
+
+/*
+ * Finds the point a walk plots at a given step.
+ */
+typedef void (*Locate)(void *walk, long long k, long long *x, long long *y);
+
+/*
+ * Find the steps of a walk that plot inside of a rectangle.
+ *
+ * Both coordinates of the points plotted over steps `k1` to
+ * `k2` must be monotone, so the steps landing in `r` form a
+ * single range that can be binary searched for.
+ *
+ * @param at Locates the point plotted at a step.
+ * @param walk The walk passed to `at`.
+ * @param k1 The first step.
+ * @param k2 The last step.
+ * @param r The rectangle.
+ * @param first Set to the first step inside of `r`.
+ * @param last Set to the last step inside of `r`.
+ * @return Whether or not any step lands inside of `r`.
+ */
+int clip_walk(
+  Locate at,
+  void *walk,
+  long long k1,
+  long long k2,
+  struct Rect r,
+  long long *first,
+  long long *last
+) {
+  long long lo[2] = { r.x1, r.y1 }, hi[2] = { r.x2, r.y2 }, a[2], b[2], v[2];
+
+  at(walk, k1, &a[0], &a[1]);
+  at(walk, k2, &b[0], &b[1]);
+
+  *first = k1;
+  *last = k2;
+
+  for (int axis = 0; axis < 2; ++axis) {
+    long long s = b[axis] >= a[axis] ? 1 : -1,
+              low = s > 0 ? lo[axis] : -hi[axis],
+              high = s > 0 ? hi[axis] : -lo[axis],
+              l = *first,
+              h = *last + 1;
+
+    while (l < h) {
+      long long m = l + (h - l) / 2;
+      at(walk, m, &v[0], &v[1]);
+      s * v[axis] >= low ? (h = m) : (l = m + 1);
+    }
+
+    *first = l;
+    h = *last + 1;
+
+    while (l < h) {
+      long long m = l + (h - l) / 2;
+      at(walk, m, &v[0], &v[1]);
+      s * v[axis] > high ? (h = m) : (l = m + 1);
+    }
+
+    *last = l - 1;
+
+    if (*first > *last) return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * A line being walked by `bresenham_line`, along its major
+ * axis `x` and minor axis `y`.
+ */
+struct LineWalk {
+  long long x1;
+  long long y1;
+  long long dx;
+  long long dy;
+  int sx;
+  int sy;
+  bool decide;
+};
+
+/*
+ * Compute the state of a line walk before step `k`, for any
+ * `k` up to `dx`, without stepping through the ones before it.
+ *
+ * The minor axis has advanced `floor((2 * dy * k + dx) / (2 * dx))`
+ * times by then, which fixes the decision variable as well.
+ *
+ * @param w A pointer to a line walk.
+ * @param k The step.
+ * @param x Set to the major coordinate.
+ * @param y Set to the minor coordinate.
+ * @param pk Set to the decision variable.
+ */
+void line_state(struct LineWalk *w, long long k, long long *x, long long *y, long long *pk) {
+  long long m = k && w->dx ? (2 * w->dy * k + w->dx) / (2 * w->dx) : 0;
+
+  *x = w->x1 + w->sx * k;
+  *y = w->y1 + w->sy * m;
+  *pk = 2 * w->dy - w->dx + 2 * w->dy * k - 2 * w->dx * m;
+}
+
+/*
+ * Locate the point a line walk plots at step `k`, for any `k`
+ * below `dx`.
+ *
+ * @param walk A pointer to a line walk.
+ * @param k The step.
+ * @param x Set to the x coordinate.
+ * @param y Set to the y coordinate.
+ */
+void line_at(void *walk, long long k, long long *x, long long *y) {
+  struct LineWalk *w = (struct LineWalk*)walk;
+
+  long long major, minor, pk;
+
+  line_state(w, k + 1, &major, &minor, &pk);
+
+  *x = w->decide ? minor : major;
+  *y = w->decide ? major : minor;
+}
+
+/*
+ * Run some steps of Bresenham's line drawing algorithm.
+ *
+ * @param grid A pointer to a grid.
+ * @param w A pointer to a line walk.
+ * @param x2
+ * @param y2
+ * @param k The first step.
+ * @param count The number of steps.
+ * @return Whether or not the last step plotted inside of the
+ *         clipping rectangle.
+ */
+int bresenham_line_steps(
+  struct Grid *grid,
+  struct LineWalk *w,
+  int x2,
+  int y2,
+  long long k,
+  long long count
+) {
+  long long major, minor, p;
+
+  line_state(w, k, &major, &minor, &p);
+
+  int x1 = (int)major, y1 = (int)minor, pk = (int)p, dx = (int)w->dx, dy = (int)w->dy;
+
+  bool decide = w->decide;
+
+  for (long long i = 0; i < count; ++i) {
+    x1 < x2 ? ++x1 : --x1;
+
+    if (pk < 0) {
+      decide ? plot(grid, y1, x1) : plot(grid, x1, y1);
+      pk = pk + 2 * dy;
+    } else {
+      y1 < y2 ? ++y1 : --y1;
+      decide ? plot(grid, y1, x1) : plot(grid, x1, y1);
+      pk = pk + 2 * dy - 2 * dx;
+    }
+  }
+
+  return decide ? in_rect(grid->clip, y1, x1) : in_rect(grid->clip, x1, y1);
+}
+
+/*
+ * Bresenham's line drawing algorithm.
+ *
+ * Details for understanding can be found here:
+ * https://en.wikipedia.org/wiki/Bresenham's_line_algorithm
+ *
+ * Only the steps plotting inside of the grid's clipping
+ * rectangle are walked, starting from their computed state, so
+ * a huge line can be split between workers owning different
+ * parts of the canvas. The final step walks past the end point
+ * and is always run on its own.
+ *
+ * @param grid A pointer to a grid.
+ * @param x1
+ * @param y1
+ * @param x2
+ * @param y2
+ * @param dx The difference in x values.
+ * @param dy The difference in y values.
+ */
+void bresenham_line(
+  struct Grid *grid,
+  int x1,
+  int y1,
+  int x2,
+  int y2,
+  int dx,
+  int dy,
+  bool decide
+) {
+  struct LineWalk w = { x1, y1, dx, dy, x2 > x1 ? 1 : -1, y2 > y1 ? 1 : -1, decide };
+
+  long long first, last;
+
+  if (dx > 0 && clip_walk(line_at, &w, 0, dx - 1, grid->clip, &first, &last)) {
+    bresenham_line_steps(grid, &w, x2, y2, first, last - first + 1);
+    grid->plotted += last - first + 1;
+  }
+
+  grid->plotted += bresenham_line_steps(grid, &w, x2, y2, dx, 1);
+}
+
+/*
+ * The largest radius `bresenham_circle` splits into arcs, which
+ * keeps its closed form arithmetic within 64 bits.
+ */
+#define ARC_RADIUS_MAX (1 << 29)
+
+/*
+ * The signs and axis swap of the point each octant of a circle
+ * plots for a step (`x`, `y`), in the order `bresenham_circle`
+ * plots them.
+ */
+const static struct {
+  int sx;
+  int sy;
+  bool swap;
+} OCTANTS [] = {
+  {  1,  1, false },
+  {  1, -1, false },
+  {  1,  1, true  },
+  {  1, -1, true  },
+  { -1,  1, false },
+  { -1, -1, false },
+  { -1,  1, true  },
+  { -1, -1, true  }
+};
+
+/*
+ * One octant of a circle being walked by `bresenham_circle`.
+ */
+struct ArcWalk {
+  long long xc;
+  long long yc;
+  long long radius;
+  int octant;
+};
+
+/*
+ * Compute the decision variable of `bresenham_circle` at a
+ * step (`x`, `y`), which only depends on the point.
+ *
+ * @param radius The circle radius.
+ * @param x The x offset from the center.
+ * @param y The y offset from the center.
+ * @return The decision variable.
+ */
+long long arc_decision(long long radius, long long x, long long y) {
+  return 2 * x * x + 2 * y * y + 8 * x - 6 * y + 3 + 4 * radius - 2 * radius * radius;
+}
+
+/*
+ * A helper to compute the integer square root of a number.
+ *
+ * @param n The number.
+ * @return The largest integer whose square is at most `n`.
+ */
+long long isqrt(long long n) {
+  if (n <= 0) return 0;
+
+  long long x = n, y = (x + 1) / 2;
+
+  while (y < x) {
+    x = y;
+    y = (x + n / x) / 2;
+  }
+
+  return x;
+}
+
+/*
+ * Compute the y offset of `bresenham_circle` after step `k`
+ * without stepping through the ones before it.
+ *
+ * It is the largest `y` whose decision variable at `x = k - 1`
+ * isn't positive. That holds while the arc is shallow, which is
+ * whenever the result is at least `k + 2`.
+ *
+ * @param radius The circle radius.
+ * @param k The step, at least 1.
+ * @return The y offset.
+ */
+long long arc_y(long long radius, long long k) {
+  long long c = arc_decision(radius, k - 1, 0), y = (6 + isqrt(36 - 8 * c)) / 4;
+
+  while (y > 0 && 2 * y * y - 6 * y + c > 0) --y;
+  while (2 * (y + 1) * (y + 1) - 6 * (y + 1) + c <= 0) ++y;
+
+  return y;
+}
+
+/*
+ * Locate the point an octant of a circle plots at step `k`.
+ *
+ * @param walk A pointer to an arc walk.
+ * @param k The step.
+ * @param x Set to the x coordinate.
+ * @param y Set to the y coordinate.
+ */
+void arc_at(void *walk, long long k, long long *x, long long *y) {
+  struct ArcWalk *w = (struct ArcWalk*)walk;
+
+  long long ay = arc_y(w->radius, k);
+
+  *x = w->xc + OCTANTS[w->octant].sx * (OCTANTS[w->octant].swap ? ay : k);
+  *y = w->yc + OCTANTS[w->octant].sy * (OCTANTS[w->octant].swap ? k : ay);
+}
+
+/*
+ * Plot the point a circle step (`x`, `y`) lands on in each of
+ * the eight octants.
+ *
+ * @param grid A pointer to a grid.
+ * @param xc The center x coordinate.
+ * @param yc The center y coordinate.
+ * @param x The step's offset along the octant.
+ * @param y The step's offset across the octant.
+ */
+void plot_octants(struct Grid *grid, int xc, int yc, int x, int y) {
+  struct Rect c = grid->clip;
+
+  plot(grid, xc + x, yc + y);
+  plot(grid, xc + x, yc - y);
+  plot(grid, xc + y, yc + x);
+  plot(grid, xc + y, yc - x);
+  plot(grid, xc - x, yc + y);
+  plot(grid, xc - x, yc - y);
+  plot(grid, xc - y, yc + x);
+  plot(grid, xc - y, yc - x);
+
+  grid->plotted +=
+    in_rect(c, xc + x, yc + y) + in_rect(c, xc + x, yc - y) +
+    in_rect(c, xc + y, yc + x) + in_rect(c, xc + y, yc - x) +
+    in_rect(c, xc - x, yc + y) + in_rect(c, xc - x, yc - y) +
+    in_rect(c, xc - y, yc + x) + in_rect(c, xc - y, yc - x);
+}
+
+/*
+ * Bresenham's circle drawing algorithm.
+ *
+ * Details for understanding can be found here:
+ * https://www.javatpoint.com/computer-graphics-bresenhams-circle-algorithm
+ *
+ * While the arc is shallow every octant is walked on its own,
+ * over just the steps plotting inside of the grid's clipping
+ * rectangle and starting from their computed state, so a huge
+ * circle can be split between workers owning different parts
+ * of the canvas. The last few steps are walked as usual.
+ *
+ * @param grid A pointer to a grid.
+ * @param xc The center x coordinate.
+ * @param yc The center y coordinate.
+ * @param radius The circle radius.
+ */
+void bresenham_circle(
+  struct Grid *grid,
+  int xc,
+  int yc,
+  int radius
+) {
+  int x = 0, y = radius, d = 3 - 2 * radius;
+
+  plot_octants(grid, xc, yc, x, y);
+
+  long long shallow = 0, l = 1, h = radius;
+
+  if (radius > 2 && radius <= ARC_RADIUS_MAX) {
+    while (l <= h) {
+      long long m = l + (h - l) / 2;
+      arc_y(radius, m) >= m + 2 ? (shallow = m, l = m + 1) : (h = m - 1);
+    }
+  }
+
+  for (int o = 0; shallow && o < 8; ++o) {
+    struct ArcWalk w = { xc, yc, radius, o };
+
+    long long first, last;
+
+    if (!clip_walk(arc_at, &w, 1, shallow, grid->clip, &first, &last))
+      continue;
+
+    int ax = (int)first, ay = (int)arc_y(radius, first),
+        ad = (int)arc_decision(radius, ax, ay),
+        sx = OCTANTS[o].sx, sy = OCTANTS[o].sy;
+
+    grid->plotted += last - first + 1;
+
+    for (long long k = first; k <= last; ++k) {
+      OCTANTS[o].swap ?
+        plot(grid, xc + sx * ay, yc + sy * ax) :
+        plot(grid, xc + sx * ax, yc + sy * ay);
+
+      ++ax;
+
+      if (ad > 0) {
+        ay--;
+        ad = ad + 4 * (ax - ay) + 10;
+      } else {
+        ad = ad + 4 * ax + 6;
+      }
+    }
+  }
+
+  if (shallow) {
+    x = (int)shallow;
+    y = (int)arc_y(radius, shallow);
+    d = (int)arc_decision(radius, x, y);
+  }
+
+  while (y >= x) {
+    ++x;
+
+    if (d > 0) {
+      y--;
+      d = d + 4 * (x - y) + 10;
+    } else {
+      d = d + 4 * x + 6;
+    }
+
+    plot_octants(grid, xc, yc, x, y);
+  }
+}
+
+/*
+ * Handler for the `CHAR` operation.
+ *
+ * @param grid A pointer to a grid.
+ * @param args [character, ..].
+ */
+void character(struct Grid *grid, int args[]) {
+  grid->character = (char)args[0];
+}
+
+/*
+ * Handler for the `CIRCLE` operation.
+ *
+ * @param grid A pointer to a grid
+ * @param args [x, y, radius, ..].
+ */
+void circle(struct Grid *grid, int args[]) {
+  int x = args[0], y = args[1], radius = args[2];
+
+  if (!grid->initialized) {
+    fprintf(out(), "error: Grid isn't initialized\n");
+    return;
+  }
+
+  bresenham_circle(grid, x, y, radius);
+}
+
+/*
+ * Blank the band of rows owned by a worker by handing its
+ * pages back to the kernel, they read as zero from then on.
+ *
+ * @param ctx A pointer to a grid.
+ * @param worker The worker number.
+ */
+void clear_band(void *ctx, int worker) {
+  struct Grid *grid = (struct Grid*)ctx;
+  struct Rect r = band(grid, worker);
+
+  if (r.y1 > r.y2) return;
+
+  for (int s = r.y1 / TILE_SIZE; s <= r.y2 / TILE_SIZE; ++s) {
+    if (grid->strips[s].packed) memory_add(MEMORY_CANVAS, -(long)grid->strips[s].packed_size);
+    slab_free(grid->strips[s].packed, grid->strips[s].packed_size);
+    grid->strips[s] = (struct Strip) { 0 };
+  }
+
+  madvise(
+    row(grid, r.y1),
+    (size_t)(r.y2 / TILE_SIZE - r.y1 / TILE_SIZE + 1) * grid->stride,
+    MADV_DONTNEED
+  );
+}
+
+/*
+ * Handler for the `CLEAR` operation.
+ *
+ * @param grid A pointer to a grid
+ */
+void clear(struct Grid *grid) {
+  if (!grid->initialized) return;
+
+  pool_run(grid->pool, clear_band, grid);
+
+  ++grid->version;
+  memset(grid->dirty, 1, grid->tiles_x * grid->tiles_y);
+}
+
+/*
+ * Copy cells, turning blank cells into spaces.
+ *
+ * @param dst The destination.
+ * @param src The cells.
+ * @param n The number of cells.
+ */
+void unblank(char *dst, const char *src, size_t n) {
+  size_t i = 0;
+
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128(), space = _mm_set1_epi8(' ');
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i blank = _mm_and_si128(_mm_cmpeq_epi8(v, zero), space);
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(v, blank));
+  }
+#endif
+
+  for (; i < n; ++i)
+    dst[i] = src[i] ? src[i] : ' ';
+}
+
+/*
+ * Print the cells of a region of the grid along with their
+ * row and column numbers.
+ *
+ * @param grid A grid struct.
+ * @param r The region to print, which must lie within the grid.
+ */
+void display_region(struct Grid grid, struct Rect r) {
+  int wrap = 10;
+
+  size_t width = r.x2 - r.x1 + 1;
+
+  char *line = (char*)malloc(width + 1);
+
+  line[width] = '\n';
+
+  count(&counters()->frames, 1);
+
+  thaw(&grid, r.y1, r.y2);
+
+  for (int i = r.y2; i >= r.y1; --i) {
+    fprintf(out(), "%d ", ((i - wrap) % wrap + wrap) % wrap);
+    unblank(line, row(&grid, i) + r.x1, width);
+    fwrite(line, 1, width + 1, out());
+  }
+
+  free(line);
+
+  fprintf(out(), " ");
+
+  for (int i = r.x1; i <= r.x2; ++i)
+    fprintf(out(), "%d", ((i - wrap) % wrap + wrap) % wrap);
+
+  fprintf(out(), "\n");
+}
+
+/*
+ * Handler for the `DISPLAY` operation.
+ *
+ * @param grid A grid struct.
+ */
+void display(struct Grid grid) {
+  if (!grid.initialized) {
+    fprintf(out(), "error: Grid isn't initialized\n");
+    return;
+  }
+
+  display_region(grid, grid.clip);
+}
+
+/*
+ * Handler for the `GRID` operation.
+ *
+ * @param grid A pointer to a grid.
+ * @param args [width, height, ..].
+ */
+void grid(struct Grid *grid, int args[]) {
+  int width = args[0], height = args[1];
+
+  if (grid->initialized) {
+    fprintf(out(), "error: Grid has already been initialized\n");
+    return;
+  }
+
+  if (width <= 0 || height <= 0) {
+    fprintf(out(), "error: Grid dimensions must be positive\n");
+    return;
+  }
+
+  size_t page = sysconf(_SC_PAGESIZE),
+         stride = ((size_t)TILE_SIZE * width + page - 1) / page * page;
+
+  void *cells = canvas_map(stride * ((height + TILE_SIZE - 1) / TILE_SIZE));
+
+  if (cells == MAP_FAILED) {
+    fprintf(out(), "error: Grid is too large\n");
+    return;
+  }
+
+  size_t strips = sizeof(struct Strip) * ((height + TILE_SIZE - 1) / TILE_SIZE),
+         tiles = (size_t)((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1) / TILE_SIZE);
+
+  struct Strip *bookkeeping = (struct Strip*)slab_calloc(strips);
+  char *dirty = (char*)slab_alloc(tiles);
+
+  if (!bookkeeping || !dirty) {
+    slab_free(bookkeeping, strips);
+    slab_free(dirty, tiles);
+    canvas_unmap(cells, stride * ((height + TILE_SIZE - 1) / TILE_SIZE));
+    fprintf(out(), "error: Grid is too large\n");
+    return;
+  }
+
+  grid->cells = (char*)cells;
+  grid->stride = stride;
+  grid->strips = bookkeeping;
+  grid->width = width;
+  grid->height = height;
+
+  grid->tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+  grid->tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+  grid->dirty = dirty;
+
+  memset(grid->dirty, 1, grid->tiles_x * grid->tiles_y);
+
+  memory_add(
+    MEMORY_CANVAS,
+    sizeof(struct Strip) * ((height + TILE_SIZE - 1) / TILE_SIZE) + grid->tiles_x * grid->tiles_y
+  );
+
+  grid->clip = (struct Rect) { 0, 0, width - 1, height - 1 };
+  grid->initialized = 1;
+}
+
+/*
+ * Release everything a grid holds, leaving it uninitialized.
+ *
+ * @param grid A pointer to a grid.
+ */
+void grid_free(struct Grid *grid) {
+  if (!grid->initialized) return;
+
+  int strips = (grid->height + TILE_SIZE - 1) / TILE_SIZE;
+
+  for (int s = 0; s < strips; ++s) {
+    if (grid->strips[s].packed) memory_add(MEMORY_CANVAS, -(long)grid->strips[s].packed_size);
+    slab_free(grid->strips[s].packed, grid->strips[s].packed_size);
+  }
+
+  if (grid->pyramid.built) {
+    memory_add(MEMORY_CACHES, -pyramid_bytes(grid));
+
+    for (int k = 1; k <= grid->pyramid.levels; ++k)
+      free(grid->pyramid.counts[k - 1]);
+
+    free(grid->pyramid.counts);
+  }
+
+  canvas_unmap(grid->cells, grid->stride * strips);
+
+  slab_free(grid->strips, sizeof(struct Strip) * strips);
+  slab_free(grid->dirty, grid->tiles_x * grid->tiles_y);
+
+  memory_add(MEMORY_CANVAS, -(long)(sizeof(struct Strip) * strips + grid->tiles_x * grid->tiles_y));
+
+  grid->pyramid = (struct Pyramid) { 0 };
+  grid->initialized = 0;
+}
+
+/*
+ * Handler for the `LINE` operation.
+ *
+ * @param grid A pointer to a grid.
+ * @param args [x1, y1, x2, y2].
+ */
+void line(struct Grid *grid, int args[]) {
+  int x1 = args[0], y1 = args[1], x2 = args[2], y2 = args[3];
+
+  if (!grid->initialized) {
+    fprintf(out(), "error: Grid isn't initialized\n");
+    return;
+  }
+
+  plot(grid, x1, y1);
+
+  grid->plotted += in_rect(grid->clip, x1, y1);
+
+  int dx = abs(x2 - x1), dy = abs(y2 - y1);
+
+  dx > dy ?
+    bresenham_line(grid, x1, y1, x2, y2, dx, dy, false) :
+    bresenham_line(grid, y1, x1, y2, x2, dy, dx, true);
+}
+
+/*
+ * Handler for the `POINT` operation.
+ *
+ * @param grid A pointer to a grid.
+ * @param args [x, y, ..].
+ */
+void point(struct Grid *grid, int args[]) {
+  int x = args[0], y = args[1];
+
+  if (!grid->initialized) {
+    fprintf(out(), "error: Grid isn't initialized\n");
+    return;
+  }
+
+  plot(grid, x, y);
+
+  grid->plotted += in_rect(grid->clip, x, y);
+}
+
+/*
+ * Handler for the `RECTANGLE` operation.
+ *
+ * @param grid A pointer to a grid.
+ * @param args [x1, y1, x2, y2].
+ */
+void rectangle(struct Grid *grid, int args[]) {
+  int x1 = args[0], y1 = args[1], x2 = args[2], y2 = args[3];
+
+  if (!grid->initialized) {
+    fprintf(out(), "error: Grid isn't initialized\n");
+    return;
+  }
+
+  if (x1 > x2) {
+    int temp = x1;
+    x1 = x2;
+    x2 = temp;
+  }
+
+  if (y1 > y2) {
+    int temp = y1;
+    y1 = y2;
+    y2 = temp;
+  }
+
+  line(grid, (int[]) { x1 + abs(x2 - x1), y1, x2, y2 });
+  line(grid, (int[]) { x1, y1 + abs(y2 - y1), x1, y1 });
+  line(grid, (int[]) { x1, y1, x1 + abs(x2 - x1), y1 });
+  line(grid, (int[]) { x2, y2, x1, y1 + abs(y2 - y1) });
+}
+
+/*
+ * Handler for the `STATS` operation.
+ *
+ * @param grid A pointer to a grid.
+ */
+void stats(struct Grid *grid) {
+  if (!grid->initialized) {
+    fprintf(out(), "error: Grid isn't initialized\n");
+    return;
+  }
+
+  int strips = (grid->height + TILE_SIZE - 1) / TILE_SIZE, packed = 0;
+
+  size_t raw = 0, size = 0;
+
+  for (int s = 0; s < strips; ++s)
+    if (grid->strips[s].packed) {
+      ++packed;
+      raw += strip_cells(grid, s);
+      size += grid->strips[s].packed_size;
+    }
+
+  fprintf(out(), "cells: %d x %d\n", grid->width, grid->height);
+  fprintf(out(), "strips: %d (%d compressed)\n", strips, packed);
+  fprintf(
+    out(),
+    "compression: %.2fx (%zu -> %zu bytes)\n",
+    size ? (double)raw / size : 1.0,
+    raw,
+    size
+  );
+
+  slab_stats();
+  memory_stats();
+}
+
+/*
+ * A drawing operation waiting to be rasterized, along with
+ * the character it draws with and the cells it may touch.
+ */
+struct Primitive {
+  enum Command cmd;
+  int args[ARGS_MAX];
+  char character;
+  struct Rect box;
+  unsigned long seq;
+};
+
+/*
+ * The primitives drawn since the canvas was last brought up
+ * to date, in the order they were issued.
+ *
+ * Every primitive gets the next sequence number, which keeps
+ * increasing across flushes.
+ */
+struct DisplayList {
+  struct Primitive *items;
+  size_t size;
+  size_t capacity;
+  unsigned long seq;
+};
+
+/*
+ * A helper to clamp a coordinate to the range of an `int`.
+ *
+ * @param v The coordinate.
+ * @return The clamped coordinate.
+ */
+int clamp(long long v) {
+  return v < INT_MIN ? INT_MIN : v > INT_MAX ? INT_MAX : (int)v;
+}
+
+/*
+ * Compute a rectangle containing every cell an operation may
+ * plot.
+ *
+ * Lines step one cell past their end point and tiny circles
+ * spill past their radius, so boxes are padded by a cell.
+ *
+ * @param cmd The drawing command.
+ * @param args The command arguments.
+ * @return The bounding box.
+ */
+struct Rect bounding_box(enum Command cmd, int args[]) {
+  long long x1 = args[0], y1 = args[1], x2 = args[2], y2 = args[3];
+
+  switch (cmd) {
+    case CIRCLE:
+      x2 = llabs(x2) + 1;
+      return (struct Rect) {
+        clamp(x1 - x2), clamp(y1 - x2), clamp(x1 + x2), clamp(y1 + x2)
+      };
+    case POINT:
+      return (struct Rect) { (int)x1, (int)y1, (int)x1, (int)y1 };
+    default:
+      return (struct Rect) {
+        clamp((x1 < x2 ? x1 : x2) - 1),
+        clamp((y1 < y2 ? y1 : y2) - 1),
+        clamp((x1 > x2 ? x1 : x2) + 1),
+        clamp((y1 > y2 ? y1 : y2) + 1)
+      };
+  }
+}
+
+/*
+ * Append a drawing operation to a display list.
+ *
+ * @param list A pointer to a display list.
+ * @param grid A grid struct, whose character is captured.
+ * @param op An operation struct.
+ */
+void push(struct DisplayList *list, struct Grid grid, struct Operation op) {
+  if (list->size == list->capacity) {
+    size_t old = list->capacity, capacity = old ? old * 2 : 64;
+
+    struct Primitive *items = (struct Primitive*)slab_realloc(
+      list->items,
+      sizeof(struct Primitive) * old,
+      sizeof(struct Primitive) * capacity
+    );
+
+    if (!items) {
+      fprintf(out(), "error: Out of memory\n");
+      return;
+    }
+
+    list->items = items;
+    list->capacity = capacity;
+
+    memory_add(MEMORY_OPERATIONS, sizeof(struct Primitive) * (capacity - old));
+  }
+
+  struct Primitive *p = &list->items[list->size++];
+
+  count(&counters()->enqueued[QUEUE_DISPLAY_LIST], 1);
+
+  p->cmd = op.cmd;
+  p->seq = ++list->seq;
+  p->character = grid.character;
+  p->box = bounding_box(op.cmd, op.args);
+
+  memcpy(p->args, op.args, sizeof(p->args));
+}
+
+/*
+ * Rasterize a primitive into the grid, limited to the grid's
+ * clipping rectangle, and count the cells it took.
+ *
+ * @param grid A pointer to a grid.
+ * @param p A pointer to a primitive.
+ */
+void draw(struct Grid *grid, struct Primitive *p) {
+  if (!intersects(p->box, grid->clip)) return;
+
+  grid->character = p->character;
+  grid->seq = p->seq;
+  grid->plotted = 0;
+
+  switch (p->cmd) {
+    case CIRCLE:
+      circle(grid, p->args);
+      break;
+    case LINE:
+      line(grid, p->args);
+      break;
+    case POINT:
+      point(grid, p->args);
+      break;
+    case RECTANGLE:
+      rectangle(grid, p->args);
+      break;
+    default:
+      break;
+  }
+
+  count(&counters()->cells, grid->plotted);
+}
+
+/*
+ * The argument of a flush task.
+ */
+struct Flush {
+  struct Grid *grid;
+  struct DisplayList *list;
+};
+
+/*
+ * Rasterize every pending primitive into the band of rows owned
+ * by a worker.
+ *
+ * Each worker draws through its own copy of the grid, clipped
+ * to its band, in display list order. Bands don't share cells
+ * so the result matches drawing everything on one thread.
+ *
+ * @param ctx A pointer to a flush struct.
+ * @param worker The worker number.
+ */
+void flush_band(void *ctx, int worker) {
+  struct Flush *f = (struct Flush*)ctx;
+  struct Grid local = *f->grid;
+  struct Rect r = band(f->grid, worker);
+
+  if (r.y1 > r.y2) return;
+
+  local.clip = r;
+
+  for (size_t i = 0; i < f->list->size; ++i)
+    draw(&local, &f->list->items[i]);
+}
+
+/*
+ * The most buckets along either axis used to find conflicting
+ * primitives when drawing with `RENDER_DAG`.
+ */
+#define DAG_BUCKETS 128
+
+/*
+ * The dependency graph of a display list, along with the queue
+ * of primitives ready to be drawn.
+ *
+ * The successors of primitive `i` are
+ * `edges[offsets[i]..offsets[i + 1]]`.
+ */
+struct Dag {
+  struct Grid *grid;
+  struct DisplayList *list;
+  atomic_int *pending;
+  size_t *offsets;
+  size_t *edges;
+  size_t *ready;
+  size_t queued;
+  size_t done;
+  pthread_mutex_t lock;
+  pthread_cond_t more;
+};
+
+/*
+ * Draw primitives as their dependencies complete, until the
+ * whole graph is drawn.
+ *
+ * @param ctx A pointer to a dag struct.
+ * @param worker The worker number.
+ */
+void dag_worker(void *ctx, int worker) {
+  (void)worker;
+
+  struct Dag *dag = (struct Dag*)ctx;
+  struct Grid local = *dag->grid;
+
+  size_t n = dag->list->size;
+
+  pthread_mutex_lock(&dag->lock);
+
+  for (;;) {
+    while (!dag->queued && dag->done < n)
+      pthread_cond_wait(&dag->more, &dag->lock);
+
+    if (!dag->queued) break;
+
+    size_t i = dag->ready[--dag->queued];
+
+    pthread_mutex_unlock(&dag->lock);
+
+    draw(&local, &dag->list->items[i]);
+
+    size_t unblocked = 0;
+
+    for (size_t e = dag->offsets[i]; e < dag->offsets[i + 1]; ++e)
+      if (atomic_fetch_sub(&dag->pending[dag->edges[e]], 1) == 1)
+        dag->edges[dag->offsets[i] + unblocked++] = dag->edges[e];
+
+    pthread_mutex_lock(&dag->lock);
+
+    for (size_t e = 0; e < unblocked; ++e)
+      dag->ready[dag->queued++] = dag->edges[dag->offsets[i] + e];
+
+    if (++dag->done == n || unblocked)
+      pthread_cond_broadcast(&dag->more);
+  }
+
+  pthread_mutex_unlock(&dag->lock);
+}
+
+/*
+ * Rasterize the display list by running primitives that don't
+ * overlap at the same time.
+ *
+ * The canvas is split into buckets and every primitive depends on
+ * the previous primitive touching each bucket its box covers, so
+ * primitives only wait on earlier ones they might share cells
+ * with. Following these edges keeps the result identical to
+ * drawing in display list order.
+ *
+ * @param grid A pointer to a grid.
+ * @param list A pointer to a display list.
+ */
+void flush_dag(struct Grid *grid, struct DisplayList *list) {
+  size_t n = list->size, edges = 0, capacity = n;
+
+  int side = TILE_SIZE, longest = grid->width > grid->height ? grid->width : grid->height;
+
+  while ((long)side * DAG_BUCKETS < longest)
+    side *= 2;
+
+  int bx = (grid->width + side - 1) / side, by = (grid->height + side - 1) / side;
+
+  long *last = (long*)malloc(sizeof(long) * bx * by);
+  size_t *seen = (size_t*)malloc(sizeof(size_t) * n),
+         *from = (size_t*)malloc(sizeof(size_t) * capacity),
+         *to = (size_t*)malloc(sizeof(size_t) * capacity);
+
+  for (int b = 0; b < bx * by; ++b)
+    last[b] = -1;
+
+  struct Dag dag = {
+    .grid = grid,
+    .list = list,
+    .pending = (atomic_int*)malloc(sizeof(atomic_int) * n),
+    .offsets = (size_t*)calloc(n + 1, sizeof(size_t)),
+    .ready = (size_t*)malloc(sizeof(size_t) * n)
+  };
+
+  for (size_t j = 0; j < n; ++j) {
+    struct Rect r = list->items[j].box;
+
+    int count = 0;
+
+    seen[j] = j;
+
+    if (intersects(r, grid->clip)) {
+      if (r.x1 < 0) r.x1 = 0;
+      if (r.y1 < 0) r.y1 = 0;
+      if (r.x2 >= grid->width) r.x2 = grid->width - 1;
+      if (r.y2 >= grid->height) r.y2 = grid->height - 1;
+
+      for (int y = r.y1 / side; y <= r.y2 / side; ++y)
+        for (int x = r.x1 / side; x <= r.x2 / side; ++x) {
+          long i = last[y * bx + x];
+
+          last[y * bx + x] = j;
+
+          if (i < 0 || seen[i] == j) continue;
+
+          seen[i] = j;
+
+          if (edges == capacity) {
+            capacity *= 2;
+            from = (size_t*)realloc(from, sizeof(size_t) * capacity);
+            to = (size_t*)realloc(to, sizeof(size_t) * capacity);
+          }
+
+          from[edges] = i;
+          to[edges++] = j;
+          ++dag.offsets[i + 1];
+          ++count;
+        }
+    }
+
+    atomic_init(&dag.pending[j], count);
+
+    if (!count) dag.ready[dag.queued++] = j;
+  }
+
+  for (size_t i = 0; i < n; ++i)
+    dag.offsets[i + 1] += dag.offsets[i];
+
+  dag.edges = (size_t*)malloc(sizeof(size_t) * (edges ? edges : 1));
+
+  for (size_t e = 0; e < edges; ++e)
+    dag.edges[dag.offsets[from[e]]++] = to[e];
+
+  for (size_t i = n; i > 0; --i)
+    dag.offsets[i] = dag.offsets[i - 1];
+
+  dag.offsets[0] = 0;
+
+  pthread_mutex_init(&dag.lock, NULL);
+  pthread_cond_init(&dag.more, NULL);
+
+  pool_run(grid->pool, dag_worker, &dag);
+
+  pthread_mutex_destroy(&dag.lock);
+  pthread_cond_destroy(&dag.more);
+
+  free(last);
+  free(seen);
+  free(from);
+  free(to);
+  free(dag.pending);
+  free(dag.offsets);
+  free(dag.edges);
+  free(dag.ready);
+}
+
+/*
+ * The argument of a stamped flush task.
+ */
+struct Stamps {
+  struct Grid *grid;
+  struct DisplayList *list;
+  atomic_size_t next;
+};
+
+/*
+ * The number of primitives a worker claims at a time when
+ * drawing with `RENDER_STAMPS`.
+ */
+#define STAMP_BATCH 64
+
+/*
+ * The number of rows of the stamped region a primitive has to
+ * span before `RENDER_STAMPS` splits it between all workers.
+ */
+#define STAMP_SPLIT_ROWS 256
+
+/*
+ * A helper to check if a primitive is split between workers
+ * when drawing with `RENDER_STAMPS`.
+ *
+ * @param grid A pointer to a grid.
+ * @param p A pointer to a primitive.
+ * @return Whether or not every worker draws its band of `p`.
+ */
+int stamp_split(struct Grid *grid, struct Primitive *p) {
+  int y1 = p->box.y1 > grid->stamped.y1 ? p->box.y1 : grid->stamped.y1,
+      y2 = p->box.y2 < grid->stamped.y2 ? p->box.y2 : grid->stamped.y2;
+
+  return pool_workers(grid->pool) > 1 && y2 - y1 >= STAMP_SPLIT_ROWS;
+}
+
+/*
+ * Claim batches of primitives and stamp them into the grid's
+ * stamp buffer, in whatever order workers get to them.
+ *
+ * Primitives spanning many rows are split instead, every worker
+ * stamps the part of each of them inside of its own band.
+ *
+ * @param ctx A pointer to a stamps struct.
+ * @param worker The worker number.
+ */
+void stamps_draw(void *ctx, int worker) {
+  struct Stamps *s = (struct Stamps*)ctx;
+  struct Grid local = *s->grid;
+
+  size_t n = s->list->size;
+
+  for (;;) {
+    size_t i = atomic_fetch_add(&s->next, STAMP_BATCH);
+
+    if (i >= n) break;
+
+    for (size_t j = i; j < n && j < i + STAMP_BATCH; ++j)
+      if (!stamp_split(s->grid, &s->list->items[j]))
+        draw(&local, &s->list->items[j]);
+  }
+
+  struct Rect r = band(s->grid, worker);
+
+  if (r.y1 < local.clip.y1) r.y1 = local.clip.y1;
+  if (r.y2 > local.clip.y2) r.y2 = local.clip.y2;
+
+  if (r.y1 > r.y2) return;
+
+  local.clip.y1 = r.y1;
+  local.clip.y2 = r.y2;
+
+  for (size_t j = 0; j < n; ++j)
+    if (stamp_split(s->grid, &s->list->items[j]))
+      draw(&local, &s->list->items[j]);
+}
+
+/*
+ * Copy the character of every stamped cell in a worker's band
+ * back into the canvas.
+ *
+ * @param ctx A pointer to a stamps struct.
+ * @param worker The worker number.
+ */
+void stamps_collapse(void *ctx, int worker) {
+  struct Grid *grid = ((struct Stamps*)ctx)->grid;
+  struct Rect r = band(grid, worker), s = grid->stamped;
+
+  int width = s.x2 - s.x1 + 1;
+
+  for (int y = r.y1 > s.y1 ? r.y1 : s.y1; y <= r.y2 && y <= s.y2; ++y)
+    for (int x = s.x1; x <= s.x2; ++x) {
+      uint64_t v = atomic_load_explicit(
+        &grid->stamps[(size_t)(y - s.y1) * width + x - s.x1],
+        memory_order_relaxed
+      );
+
+      if (v) row(grid, y)[x] = (char)(v & 0xff);
+    }
+}
+
+/*
+ * Rasterize the display list with last writer wins stamping.
+ *
+ * Workers draw primitives in any order, writing their sequence
+ * number and character into a 64 bit stamp per cell, and a
+ * stamp only replaces a smaller one. Once everything is drawn
+ * each cell holds the character of the latest primitive that
+ * touched it, exactly like drawing in order. Only the region
+ * covered by pending primitives gets a stamp buffer, and when
+ * that can't be allocated the list is drawn in bands instead.
+ *
+ * @param grid A pointer to a grid.
+ * @param list A pointer to a display list.
+ */
+void flush_stamps(struct Grid *grid, struct DisplayList *list) {
+  struct Rect r = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+
+  for (size_t i = 0; i < list->size; ++i) {
+    struct Rect b = list->items[i].box;
+
+    if (!intersects(b, grid->clip)) continue;
+
+    if (b.x1 < r.x1) r.x1 = b.x1;
+    if (b.y1 < r.y1) r.y1 = b.y1;
+    if (b.x2 > r.x2) r.x2 = b.x2;
+    if (b.y2 > r.y2) r.y2 = b.y2;
+  }
+
+  if (r.x1 > r.x2) return;
+
+  if (r.x1 < 0) r.x1 = 0;
+  if (r.y1 < 0) r.y1 = 0;
+  if (r.x2 >= grid->width) r.x2 = grid->width - 1;
+  if (r.y2 >= grid->height) r.y2 = grid->height - 1;
+
+  long stamps = (long)(r.x2 - r.x1 + 1) * (r.y2 - r.y1 + 1) * sizeof(uint64_t);
+
+  grid->stamps = (_Atomic uint64_t*)calloc(stamps / sizeof(uint64_t), sizeof(uint64_t));
+
+  if (!grid->stamps) {
+    struct Flush f = { grid, list };
+    pool_run(grid->pool, flush_band, &f);
+    return;
+  }
+
+  memory_add(MEMORY_CANVAS, stamps);
+
+  struct Stamps s = { grid, list, 0 };
+
+  grid->stamped = r;
+
+  struct Rect clip = grid->clip;
+
+  grid->clip = r;
+
+  pool_run(grid->pool, stamps_draw, &s);
+
+  grid->clip = clip;
+
+  pool_run(grid->pool, stamps_collapse, &s);
+
+  free(grid->stamps);
+  grid->stamps = NULL;
+
+  memory_add(MEMORY_CANVAS, -stamps);
+}
+
+/*
+ * Rasterize every pending primitive into the whole grid and
+ * empty the display list.
+ *
+ * @param grid A pointer to a grid.
+ * @param list A pointer to a display list.
+ */
+void flush(struct Grid *grid, struct DisplayList *list) {
+  if (!list->size) return;
+
+  for (size_t i = 0; i < list->size; ++i) {
+    mark_dirty(grid, list->items[i].box);
+    touch(grid, list->items[i].box, list->items[i].seq);
+  }
+
+  if (grid->render == RENDER_DAG && pool_workers(grid->pool) > 1) {
+    flush_dag(grid, list);
+  } else if (grid->render == RENDER_STAMPS && pool_workers(grid->pool) > 1) {
+    flush_stamps(grid, list);
+  } else {
+    struct Flush f = { grid, list };
+    pool_run(grid->pool, flush_band, &f);
+  }
+
+  count(&counters()->dequeued[QUEUE_DISPLAY_LIST], list->size);
+
+  list->size = 0;
+}
+
+/*
+ * Handler for the `VIEW` operation.
+ *
+ * Only pending primitives that intersect the viewport are
+ * rasterized, and only the part of them inside of it. They
+ * stay in the display list, redrawing a cell with the same
+ * sequence of primitives leaves it unchanged.
+ *
+ * @param grid A pointer to a grid.
+ * @param list A pointer to a display list.
+ * @param args [x, y, width, height].
+ */
+void view(struct Grid *grid, struct DisplayList *list, int args[]) {
+  int x = args[0], y = args[1], width = args[2], height = args[3];
+
+  if (!grid->initialized) {
+    fprintf(out(), "error: Grid isn't initialized\n");
+    return;
+  }
+
+  if (!in_bounds(*grid, x, y) || width <= 0 || height <= 0) {
+    fprintf(out(), "error: Viewport is out of bounds\n");
+    return;
+  }
+
+  struct Rect clip = grid->clip, r = {
+    x,
+    y,
+    width < grid->width - x ? x + width - 1 : grid->width - 1,
+    height < grid->height - y ? y + height - 1 : grid->height - 1
+  };
+
+  char character = grid->character;
+
+  grid->clip = r;
+
+  for (size_t i = 0; i < list->size; ++i)
+    if (intersects(list->items[i].box, r)) {
+      struct Rect b = list->items[i].box;
+
+      if (b.y1 < r.y1) b.y1 = r.y1;
+      if (b.y2 > r.y2) b.y2 = r.y2;
+
+      mark_dirty(grid, b);
+      touch(grid, b, list->items[i].seq);
+      draw(grid, &list->items[i]);
+    }
+
+  grid->clip = clip;
+  grid->character = character;
+
+  display_region(*grid, r);
+}
+
+/*
+ * The side length of a square tile of the viewer's cache,
+ * in screen cells.
+ */
+#define VIEWER_TILE 32
+
+/*
+ * The number of formatted tiles the viewer keeps around.
+ */
+#define VIEWER_CACHE 512
+
+/*
+ * A square of screen cells formatted at some zoom level.
+ *
+ * Row 0 of `cells` is the bottom row of the tile. `prev` and
+ * `next` link the tile into the cache's recency list, `chain`
+ * links it into its hash bucket.
+ */
+struct CachedTile {
+  int level;
+  int tx;
+  int ty;
+  int prev;
+  int next;
+  int chain;
+  char cells[VIEWER_TILE * VIEWER_TILE];
+};
+
+/*
+ * A least recently used cache of formatted viewer tiles.
+ *
+ * The cache is only valid for the canvas contents it was
+ * filled from, tracked through the grid's `version`.
+ */
+struct TileCache {
+  struct CachedTile *tiles;
+  int *buckets;
+  int size;
+  int head;
+  int tail;
+  unsigned long version;
+};
+
+/*
+ * Find the character shown for a reduced cell at a zoom level.
+ *
+ * The pyramid must be up to date for levels above 0, and cells
+ * outside of the canvas are blank.
+ *
+ * @param grid A pointer to a grid.
+ * @param level The zoom level.
+ * @param bx The reduced column.
+ * @param by The reduced row.
+ * @return The character to show.
+ */
+char shade(struct Grid *grid, int level, int bx, int by) {
+  int size = 1 << level, shades = sizeof(DENSITY) - 2;
+
+  if (
+    bx < 0 ||
+    by < 0 ||
+    bx >= level_size(grid->width, level) ||
+    by >= level_size(grid->height, level)
+  ) return ' ';
+
+  if (!level) {
+    thaw(grid, by, by);
+    return row(grid, by)[bx] ? row(grid, by)[bx] : ' ';
+  }
+
+  int cw = grid->width - bx * size < size ? grid->width - bx * size : size,
+      ch = grid->height - by * size < size ? grid->height - by * size : size;
+
+  unsigned long long area = (unsigned long long)cw * ch, count =
+    grid->pyramid.counts[level - 1][by * level_size(grid->width, level) + bx];
+
+  return DENSITY[(count * shades + area - 1) / area];
+}
+
+/*
+ * Unlink a tile from the cache's recency list.
+ *
+ * @param cache A pointer to a tile cache.
+ * @param i The tile index.
+ */
+void cache_unlink(struct TileCache *cache, int i) {
+  struct CachedTile *t = &cache->tiles[i];
+
+  if (t->prev >= 0) cache->tiles[t->prev].next = t->next;
+  else cache->head = t->next;
+
+  if (t->next >= 0) cache->tiles[t->next].prev = t->prev;
+  else cache->tail = t->prev;
+}
+
+/*
+ * Find the hash bucket of a tile.
+ *
+ * @param level The zoom level.
+ * @param tx The tile column.
+ * @param ty The tile row.
+ * @return The bucket index.
+ */
+int cache_bucket(int level, int tx, int ty) {
+  unsigned h = (unsigned)tx * 73856093u ^ (unsigned)ty * 19349663u ^ (unsigned)level * 83492791u;
+  return h % (VIEWER_CACHE * 2);
+}
+
+/*
+ * Look up a formatted tile, formatting it and evicting the
+ * least recently used tile if it isn't cached.
+ *
+ * @param cache A pointer to a tile cache.
+ * @param grid A pointer to a grid.
+ * @param level The zoom level.
+ * @param tx The tile column.
+ * @param ty The tile row.
+ * @return The tile's cells.
+ */
+char *cache_get(struct TileCache *cache, struct Grid *grid, int level, int tx, int ty) {
+  if (!cache->tiles) {
+    cache->tiles = (struct CachedTile*)malloc(sizeof(struct CachedTile) * VIEWER_CACHE);
+    cache->buckets = (int*)malloc(sizeof(int) * VIEWER_CACHE * 2);
+
+    memory_add(MEMORY_CACHES, (sizeof(struct CachedTile) + sizeof(int) * 2) * VIEWER_CACHE);
+    cache->size = 0;
+    cache->version = grid->version - 1;
+  }
+
+  if (cache->version != grid->version) {
+    for (int i = 0; i < VIEWER_CACHE * 2; ++i)
+      cache->buckets[i] = -1;
+    cache->size = 0;
+    cache->head = cache->tail = -1;
+    cache->version = grid->version;
+  }
+
+  int bucket = cache_bucket(level, tx, ty), i;
+
+  for (i = cache->buckets[bucket]; i >= 0; i = cache->tiles[i].chain) {
+    struct CachedTile *t = &cache->tiles[i];
+    if (t->level == level && t->tx == tx && t->ty == ty) break;
+  }
+
+  if (i >= 0) {
+    cache_unlink(cache, i);
+  } else {
+    if (cache->size < VIEWER_CACHE) {
+      i = cache->size++;
+    } else {
+      i = cache->tail;
+      cache_unlink(cache, i);
+
+      struct CachedTile *old = &cache->tiles[i];
+
+      int *link = &cache->buckets[cache_bucket(old->level, old->tx, old->ty)];
+
+      while (*link != i)
+        link = &cache->tiles[*link].chain;
+
+      *link = old->chain;
+    }
+
+    struct CachedTile *t = &cache->tiles[i];
+
+    t->level = level;
+    t->tx = tx;
+    t->ty = ty;
+    t->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = i;
+
+    for (int y = 0; y < VIEWER_TILE; ++y)
+      for (int x = 0; x < VIEWER_TILE; ++x)
+        t->cells[y * VIEWER_TILE + x] = shade(
+          grid,
+          level,
+          tx * VIEWER_TILE + x,
+          ty * VIEWER_TILE + y
+        );
+  }
+
+  struct CachedTile *t = &cache->tiles[i];
+
+  t->prev = -1;
+  t->next = cache->head;
+
+  if (cache->head >= 0) cache->tiles[cache->head].prev = i;
+  else cache->tail = i;
+
+  cache->head = i;
+
+  return t->cells;
+}
+
+/*
+ * A helper to floor divide a reduced coordinate by the tile
+ * size, so negative coordinates land in negative tiles.
+ *
+ * @param v The coordinate.
+ * @return The tile index.
+ */
+int tile_of(int v) {
+  return v >= 0 ? v / VIEWER_TILE : -((-v + VIEWER_TILE - 1) / VIEWER_TILE);
+}
+
+/*
+ * Compose one frame of the viewer from cached tiles and write
+ * only the rows and spans that differ from the previous frame.
+ *
+ * @param cache A pointer to a tile cache.
+ * @param grid A pointer to a grid.
+ * @param fd The terminal file descriptor.
+ * @param frame The frame to fill, `rows` by `cols`.
+ * @param last The previous frame, or `NULL` to redraw everything.
+ * @param rows The number of terminal rows.
+ * @param cols The number of terminal columns.
+ * @param level The zoom level.
+ * @param x The reduced column at the left edge.
+ * @param y The reduced row at the bottom edge.
+ */
+void viewer_frame(
+  struct TileCache *cache,
+  struct Grid *grid,
+  int fd,
+  char *frame,
+  char *last,
+  int rows,
+  int cols,
+  int level,
+  int x,
+  int y
+) {
+  int height = rows - 1;
+
+  for (int r = 0; r < height; ++r) {
+    int cy = y + height - 1 - r, ty = tile_of(cy), oy = cy - ty * VIEWER_TILE;
+
+    for (int c = 0; c < cols;) {
+      int cx = x + c, tx = tile_of(cx), ox = cx - tx * VIEWER_TILE,
+          span = VIEWER_TILE - ox < cols - c ? VIEWER_TILE - ox : cols - c;
+
+      memcpy(
+        &frame[r * cols + c],
+        &cache_get(cache, grid, level, tx, ty)[oy * VIEWER_TILE + ox],
+        span
+      );
+
+      c += span;
+    }
+  }
+
+  char status[128];
+
+  int n = snprintf(
+    status,
+    sizeof(status),
+    "level %d  x %d  y %d  arrows pan, +/- zoom, q quits",
+    level,
+    x * (1 << level),
+    y * (1 << level)
+  );
+
+  memset(&frame[height * cols], ' ', cols);
+  memcpy(&frame[height * cols], status, n < cols ? n : cols);
+
+  size_t capacity = (size_t)rows * (cols + 16) + 16, size = 0;
+
+  char *text = (char*)malloc(capacity);
+
+  for (int r = 0; r < rows; ++r) {
+    int first = 0, end = cols;
+
+    if (last) {
+      while (first < cols && frame[r * cols + first] == last[r * cols + first])
+        ++first;
+
+      if (first == cols) continue;
+
+      while (frame[r * cols + end - 1] == last[r * cols + end - 1])
+        --end;
+    }
+
+    size += sprintf(&text[size], "\x1b[%d;%dH", r + 1, first + 1);
+    memcpy(&text[size], &frame[r * cols + first], end - first);
+    size += end - first;
+  }
+
+  for (size_t written = 0; written < size;) {
+    ssize_t n = write(fd, text + written, size - written);
+    if (n <= 0) break;
+    written += n;
+  }
+
+  struct Counters *c = counters();
+
+  count(&c->frames, 1);
+  count(&c->bytes, size);
+
+  free(text);
+}
+
+/*
+ * Handler for the `VIEWER` operation.
+ *
+ * Takes over the controlling terminal to pan and zoom around
+ * the canvas until `q` is pressed.
+ *
+ * @param grid A pointer to a grid.
+ * @param cache A pointer to a tile cache.
+ */
+void viewer(struct Grid *grid, struct TileCache *cache) {
+  if (!grid->initialized) {
+    fprintf(out(), "error: Grid isn't initialized\n");
+    return;
+  }
+
+  int fd = open("/dev/tty", O_RDWR);
+
+  struct termios saved, raw;
+
+  if (fd < 0 || tcgetattr(fd, &saved)) {
+    fprintf(out(), "error: Viewer needs a terminal\n");
+    if (fd >= 0) close(fd);
+    return;
+  }
+
+  pyramid_update(grid);
+
+  raw = saved;
+  raw.c_iflag &= ~(ICRNL | IXON);
+  raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+
+  tcsetattr(fd, TCSAFLUSH, &raw);
+
+  const char *enter = "\x1b[?1049h\x1b[?25l\x1b[2J", *leave = "\x1b[?25h\x1b[?1049l";
+
+  if (write(fd, enter, strlen(enter)) < 0) {}
+
+  int level = 0, x = 0, y = 0, rows = 0, cols = 0;
+
+  char *frame = NULL, *last = NULL;
+
+  for (;;) {
+    struct winsize ws;
+
+    if (ioctl(fd, TIOCGWINSZ, &ws) || ws.ws_row < 2 || ws.ws_col < 1)
+      ws.ws_row = 24, ws.ws_col = 80;
+
+    if (ws.ws_row != rows || ws.ws_col != cols) {
+      rows = ws.ws_row;
+      cols = ws.ws_col;
+      free(frame);
+      free(last);
+      frame = (char*)malloc((size_t)rows * cols);
+      last = NULL;
+    }
+
+    viewer_frame(cache, grid, fd, frame, last, rows, cols, level, x, y);
+
+    if (!last) last = (char*)malloc((size_t)rows * cols);
+
+    memcpy(last, frame, (size_t)rows * cols);
+
+    char key[8];
+
+    ssize_t n = read(fd, key, sizeof(key));
+
+    if (n <= 0 || key[0] == 'q') break;
+
+    int step_x = cols / 4 > 0 ? cols / 4 : 1, step_y = rows / 4 > 0 ? rows / 4 : 1,
+        center_x = (x + cols / 2) * (1 << level), center_y = (y + rows / 2) * (1 << level);
+
+    if (n >= 3 && key[0] == '\x1b' && key[1] == '[') {
+      switch (key[2]) {
+        case 'A': y += step_y; break;
+        case 'B': y -= step_y; break;
+        case 'C': x += step_x; break;
+        case 'D': x -= step_x; break;
+      }
+    } else if ((key[0] == '+' || key[0] == '=') && level > 0) {
+      --level;
+      x = (center_x >> level) - cols / 2;
+      y = (center_y >> level) - rows / 2;
+    } else if (key[0] == '-' && level < grid->pyramid.levels) {
+      ++level;
+      x = (center_x >> level) - cols / 2;
+      y = (center_y >> level) - rows / 2;
+    }
+  }
+
+  if (write(fd, leave, strlen(leave)) < 0) {}
+
+  tcsetattr(fd, TCSAFLUSH, &saved);
+  close(fd);
+
+  free(frame);
+  free(last);
+}
+
+/*
+ * Handler for the `ZOOM` operation.
+ *
+ * Displays the region starting at (`x`, `y`) with every
+ * character standing in for a block of `2^level` by `2^level`
+ * cells, shaded by how much of the block is drawn on.
+ *
+ * @param grid A pointer to a grid.
+ * @param args [level, x, y, ..].
+ */
+void zoom(struct Grid *grid, int args[]) {
+  int level = args[0], x = args[1], y = args[2], wrap = 10;
+
+  if (!grid->initialized) {
+    fprintf(out(), "error: Grid isn't initialized\n");
+    return;
+  }
+
+  if (!in_bounds(*grid, x, y)) {
+    fprintf(out(), "error: Zoom origin is out of bounds\n");
+    return;
+  }
+
+  pyramid_update(grid);
+
+  if (level < 0 || level > grid->pyramid.levels) {
+    fprintf(out(), "error: Zoom level must be between 0 and %d\n", grid->pyramid.levels);
+    return;
+  }
+
+  if (!level) {
+    display_region(*grid, (struct Rect) {
+      x,
+      y,
+      x + VIEWPORT_WIDTH < grid->width ? x + VIEWPORT_WIDTH - 1 : grid->width - 1,
+      y + VIEWPORT_HEIGHT < grid->height ? y + VIEWPORT_HEIGHT - 1 : grid->height - 1
+    });
+    return;
+  }
+
+  count(&counters()->frames, 1);
+
+  int bx = x >> level, by = y >> level,
+      w = level_size(grid->width, level) - bx,
+      h = level_size(grid->height, level) - by;
+
+  if (w > VIEWPORT_WIDTH) w = VIEWPORT_WIDTH;
+  if (h > VIEWPORT_HEIGHT) h = VIEWPORT_HEIGHT;
+
+  for (int i = by + h - 1; i >= by; --i) {
+    fprintf(out(), "%d ", i % wrap);
+
+    for (int j = bx; j < bx + w; ++j)
+      fprintf(out(), "%c", shade(grid, level, j, i));
+
+    fprintf(out(), "\n");
+  }
+
+  fprintf(out(), " ");
+
+  for (int j = bx; j < bx + w; ++j)
+    fprintf(out(), "%d", j % wrap);
+
+  fprintf(out(), "\n");
+}
+
+/*
+ * The number of threads serving `--viewers` connections, which
+ * are multiplexed between them.
+ */
+#define READERS 4
+
+/*
+ * The number of frames a subscriber may fall behind by before
+ * the ones it hasn't been sent yet are skipped.
+ */
+#define FANOUT_BACKLOG 4
+
+/*
+ * A message encoded once and shared by every connection it is
+ * sent to, freed by whoever drops the last reference.
+ *
+ * Messages start with a `header` that only subscribers are sent.
+ * Frames keep the region they show so they can be diffed.
+ */
+struct Encoded {
+  atomic_int refs;
+  struct Rect clip;
+  size_t header;
+  size_t size;
+  char data[];
+};
+
+/*
+ * A read-only copy of a strip shared by every snapshot it is
+ * unchanged in. Only the publishing thread touches `refs`.
+ */
+struct SharedStrip {
+  int refs;
+  size_t size;
+  unsigned long touched;
+  char cells[];
+};
+
+/*
+ * An immutable copy of the canvas published at a `DISPLAY`.
+ *
+ * Blank strips are `NULL`. `retired` is the epoch at which the
+ * snapshot stopped being the latest one.
+ */
+struct Snapshot {
+  int width;
+  int height;
+  struct Rect clip;
+  struct SharedStrip **strips;
+  _Atomic(struct Encoded*) frame;
+  unsigned long number;
+  unsigned long retired;
+  struct Snapshot *next;
+};
+
+/*
+ * A viewer that is pushed every published frame.
+ *
+ * Messages waiting to be written sit in `pending`, with
+ * `offset` bytes of the first one already written. `key` is
+ * set while the subscriber needs a whole frame next, `hangup`
+ * once its connection is gone.
+ */
+struct Subscriber {
+  int fd;
+  int key;
+  int hangup;
+  struct Encoded *pending[FANOUT_BACKLOG + 1];
+  int head;
+  int count;
+  size_t offset;
+  struct Subscriber *next;
+};
+
+/*
+ * Publishes canvas snapshots to reader threads.
+ *
+ * Readers announce the epoch they started in through their slot
+ * in `active` before loading `current`, and clear it when done.
+ * A retired snapshot is freed once no reader announced an epoch
+ * older than its retirement, so readers never take a lock. The
+ * last slot belongs to the fan-out thread.
+ *
+ * New subscribers are pushed onto `joining` for the fan-out
+ * thread to pick up, which `wake` tells about them and about
+ * every published snapshot.
+ *
+ * Other connections are registered with `epoll`, which readers
+ * share, so a slot is only taken while a snapshot is read.
+ */
+struct Publisher {
+  _Atomic(struct Snapshot*) current;
+  atomic_ulong epoch;
+  atomic_ulong active[READERS + 1];
+  struct Snapshot *retired;
+  unsigned long published;
+  _Atomic(struct Subscriber*) joining;
+  int wake;
+  int listener;
+  int epoll;
+};
+
+/*
+ * A viewer asking for frames one line at a time.
+ *
+ * The line it is sending is gathered in `line`, `length` bytes
+ * of it so far. An answer that couldn't be written at once waits
+ * in `pending`, with `offset` bytes of it already written.
+ */
+struct Viewer {
+  int fd;
+  struct Encoded *pending;
+  size_t offset;
+  size_t length;
+  char line[256];
+};
+
+/*
+ * The startup argument of a reader thread.
+ */
+struct Reader {
+  struct Publisher *publisher;
+  int slot;
+};
+
+/*
+ * Encode a message with a header naming its kind and length.
+ *
+ * @param kind The kind of message.
+ * @param body The bytes following the header.
+ * @param n The number of bytes.
+ * @return The message, with one reference, or `NULL` if memory
+ *         ran out.
+ */
+struct Encoded *encode(const char *kind, const char *body, size_t n) {
+  char header[32];
+
+  int h = snprintf(header, sizeof(header), "%s %zu\n", kind, n);
+
+  struct Encoded *e = (struct Encoded*)slab_alloc(sizeof(struct Encoded) + h + n);
+
+  if (!e) return NULL;
+
+  atomic_init(&e->refs, 1);
+  e->header = h;
+  e->size = h + n;
+
+  memcpy(e->data, header, h);
+  memcpy(e->data + h, body, n);
+
+  return e;
+}
+
+/*
+ * Drop a reference to a message.
+ *
+ * @param e A pointer to a message.
+ */
+void encoded_release(struct Encoded *e) {
+  if (atomic_fetch_sub(&e->refs, 1) == 1) slab_free(e, sizeof(struct Encoded) + e->size);
+}
+
+/*
+ * Release a snapshot and every strip only it still holds.
+ *
+ * @param s A pointer to a snapshot.
+ */
+void snapshot_free(struct Snapshot *s) {
+  struct Encoded *frame = atomic_load(&s->frame);
+
+  if (frame) encoded_release(frame);
+
+  int strips = (s->height + TILE_SIZE - 1) / TILE_SIZE;
+
+  for (int i = 0; i < strips; ++i)
+    if (s->strips[i] && !--s->strips[i]->refs)
+      slab_free(s->strips[i], sizeof(struct SharedStrip) + s->strips[i]->size);
+
+  slab_free(s->strips, sizeof(struct SharedStrip*) * strips);
+  slab_free(s, sizeof(struct Snapshot));
+}
+
+/*
+ * Publish a snapshot of the canvas and free retired snapshots
+ * no reader can still be looking at.
+ *
+ * Strips that haven't been drawn on since the previous snapshot
+ * are shared with it rather than copied. When memory runs out
+ * nothing is published and viewers keep the previous snapshot.
+ *
+ * @param p A pointer to a publisher.
+ * @param grid A pointer to a grid.
+ */
+void publish(struct Publisher *p, struct Grid *grid) {
+  struct Snapshot *last = atomic_load(&p->current),
+                  *s = (struct Snapshot*)slab_alloc(sizeof(struct Snapshot));
+
+  int strips = (grid->height + TILE_SIZE - 1) / TILE_SIZE,
+      same = last && last->width == grid->width && last->height == grid->height;
+
+  if (!s) return;
+
+  s->width = grid->width;
+  s->height = grid->height;
+  s->clip = grid->clip;
+
+  if (!(s->strips = (struct SharedStrip**)slab_calloc(sizeof(struct SharedStrip*) * strips))) {
+    slab_free(s, sizeof(struct Snapshot));
+    return;
+  }
+
+  atomic_init(&s->frame, NULL);
+
+  for (int i = 0; i < strips; ++i) {
+    unsigned long touched = grid->strips[i].touched;
+
+    if (!touched) continue;
+
+    struct SharedStrip *old = same ? last->strips[i] : NULL;
+
+    if (old && old->touched == touched) {
+      ++old->refs;
+      s->strips[i] = old;
+      continue;
+    }
+
+    size_t n = strip_cells(grid, i);
+
+    thaw(grid, i * TILE_SIZE, i * TILE_SIZE);
+
+    if (!(s->strips[i] = (struct SharedStrip*)slab_alloc(sizeof(struct SharedStrip) + n))) {
+      snapshot_free(s);
+      return;
+    }
+
+    s->strips[i]->refs = 1;
+    s->strips[i]->size = n;
+    s->strips[i]->touched = touched;
+
+    memcpy(s->strips[i]->cells, row(grid, i * TILE_SIZE), n);
+  }
+
+  s->number = ++p->published;
+
+  if (last) {
+    atomic_exchange(&p->current, s);
+    last->retired = atomic_fetch_add(&p->epoch, 1) + 1;
+    last->next = p->retired;
+    p->retired = last;
+  } else {
+    atomic_store(&p->current, s);
+  }
+
+  uint64_t one = 1;
+
+  write(p->wake, &one, sizeof(one));
+
+  unsigned long oldest = ULONG_MAX;
+
+  for (int i = 0; i <= READERS; ++i) {
+    unsigned long e = atomic_load(&p->active[i]);
+    if (e && e < oldest) oldest = e;
+  }
+
+  for (struct Snapshot **link = &p->retired; *link;) {
+    struct Snapshot *r = *link;
+
+    if (r->retired > oldest) {
+      link = &r->next;
+      continue;
+    }
+
+    *link = r->next;
+    snapshot_free(r);
+  }
+}
+
+/*
+ * Write a whole buffer to a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param buffer The bytes to write.
+ * @param n The number of bytes.
+ * @return Whether or not everything was written.
+ */
+int write_all(int fd, const char *buffer, size_t n) {
+  while (n) {
+    ssize_t written = write(fd, buffer, n);
+
+    if (written <= 0) return 0;
+
+    count(&counters()->bytes, written);
+
+    buffer += written;
+    n -= written;
+  }
+
+  return 1;
+}
+
+/*
+ * Format a snapshot the way `DISPLAY` prints the canvas.
+ *
+ * Every row takes up the same number of bytes, a one digit label,
+ * a space, the cells and a newline, so frames can be diffed row
+ * by row.
+ *
+ * @param s A pointer to a snapshot.
+ * @return The frame, with one reference, or `NULL` if memory
+ *         ran out.
+ */
+struct Encoded *snapshot_format(struct Snapshot *s) {
+  int wrap = 10;
+
+  struct Rect r = s->clip;
+
+  size_t width = r.x2 - r.x1 + 1;
+
+  char *body = (char*)malloc((width + 3) * (r.y2 - r.y1 + 2)), *o = body;
+
+  for (int i = r.y2; i >= r.y1; --i) {
+    struct SharedStrip *strip = s->strips[i / TILE_SIZE];
+
+    *o++ = '0' + ((i - wrap) % wrap + wrap) % wrap;
+    *o++ = ' ';
+
+    if (strip)
+      unblank(o, strip->cells + (size_t)(i % TILE_SIZE) * s->width + r.x1, width);
+    else
+      memset(o, ' ', width);
+
+    o += width;
+    *o++ = '\n';
+  }
+
+  *o++ = ' ';
+
+  for (int i = r.x1; i <= r.x2; ++i)
+    *o++ = '0' + ((i - wrap) % wrap + wrap) % wrap;
+
+  *o++ = '\n';
+
+  struct Encoded *frame = encode("FRAME", body, o - body);
+
+  if (frame) frame->clip = r;
+
+  free(body);
+
+  return frame;
+}
+
+/*
+ * The frame of a snapshot, formatted by whichever thread asks
+ * for it first.
+ *
+ * @param s A pointer to a snapshot.
+ * @return The frame, owned by the snapshot, or `NULL` if memory
+ *         ran out.
+ */
+struct Encoded *snapshot_frame(struct Snapshot *s) {
+  struct Encoded *frame = atomic_load(&s->frame), *expected = NULL;
+
+  if (frame) return frame;
+
+  if (!(frame = snapshot_format(s))) return NULL;
+
+  if (atomic_compare_exchange_strong(&s->frame, &expected, frame))
+    return frame;
+
+  encoded_release(frame);
+
+  return expected;
+}
+
+/*
+ * Encode the rows that changed between two frames, each sent
+ * as its row number followed by its cells.
+ *
+ * @param last A pointer to the previous frame.
+ * @param frame A pointer to the next frame.
+ * @return The diff with one reference, or `NULL` when the frames
+ *         don't show the same region or memory ran out.
+ */
+struct Encoded *frame_diff(struct Encoded *last, struct Encoded *frame) {
+  struct Rect r = frame->clip;
+
+  if (memcmp(&r, &last->clip, sizeof(r))) return NULL;
+
+  size_t width = r.x2 - r.x1 + 1, line = width + 3;
+
+  const char *a = last->data + last->header, *b = frame->data + frame->header;
+
+  char *body = (char*)malloc((width + 13) * (r.y2 - r.y1 + 1) + 1), *o = body;
+
+  for (int i = r.y2; i >= r.y1; --i, a += line, b += line)
+    if (memcmp(a + 2, b + 2, width)) {
+      o += sprintf(o, "%d ", i);
+      memcpy(o, b + 2, width + 1);
+      o += width + 1;
+    }
+
+  struct Encoded *diff = encode("DIFF", body, o - body);
+
+  free(body);
+
+  return diff;
+}
+
+/*
+ * Queue a message for a subscriber.
+ *
+ * @param s A pointer to a subscriber.
+ * @param e A pointer to a message.
+ */
+void subscriber_queue(struct Subscriber *s, struct Encoded *e) {
+  atomic_fetch_add(&e->refs, 1);
+  s->pending[(s->head + s->count++) % (FANOUT_BACKLOG + 1)] = e;
+
+  struct Counters *c = counters();
+
+  count(&c->enqueued[QUEUE_SUBSCRIBERS], 1);
+
+  if (e->data[0] == 'F') count(&c->frames, 1);
+}
+
+/*
+ * Drop the messages a subscriber hasn't started receiving.
+ *
+ * @param s A pointer to a subscriber.
+ */
+void subscriber_skip(struct Subscriber *s) {
+  int keep = s->count && s->offset;
+
+  for (int i = keep; i < s->count; ++i)
+    encoded_release(s->pending[(s->head + i) % (FANOUT_BACKLOG + 1)]);
+
+  count(&counters()->dequeued[QUEUE_SUBSCRIBERS], s->count - keep);
+
+  s->count = keep;
+}
+
+/*
+ * Write as much of a subscriber's queued messages as its socket
+ * takes without blocking.
+ *
+ * @param s A pointer to a subscriber.
+ * @return Whether or not the subscriber is still connected.
+ */
+int subscriber_flush(struct Subscriber *s) {
+  while (s->count) {
+    struct iovec iov[FANOUT_BACKLOG + 1];
+
+    for (int i = 0; i < s->count; ++i) {
+      struct Encoded *e = s->pending[(s->head + i) % (FANOUT_BACKLOG + 1)];
+      iov[i].iov_base = e->data;
+      iov[i].iov_len = e->size;
+    }
+
+    iov[0].iov_base = (char*)iov[0].iov_base + s->offset;
+    iov[0].iov_len -= s->offset;
+
+    ssize_t written = writev(s->fd, iov, s->count);
+
+    if (written < 0) return errno == EAGAIN || errno == EINTR;
+
+    count(&counters()->bytes, written);
+
+    s->offset += written;
+
+    while (s->count && s->offset >= s->pending[s->head]->size) {
+      count(&counters()->dequeued[QUEUE_SUBSCRIBERS], 1);
+      s->offset -= s->pending[s->head]->size;
+      encoded_release(s->pending[s->head]);
+      s->head = (s->head + 1) % (FANOUT_BACKLOG + 1);
+      --s->count;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * The body of the fan-out thread, which pushes every published
+ * frame to all subscribers.
+ *
+ * Each frame and its diff against the previous one are encoded
+ * once and shared by every subscriber. Subscribers are sent diffs
+ * until they fall `FANOUT_BACKLOG` messages behind, at which point
+ * what they haven't been sent yet is skipped and replaced by the
+ * latest whole frame.
+ *
+ * @param arg A pointer to a publisher.
+ */
+void *fanout_thread(void *arg) {
+  struct Publisher *p = (struct Publisher*)arg;
+
+  struct Subscriber *subscribers = NULL;
+
+  struct Encoded *last = NULL;
+
+  struct pollfd *fds = NULL;
+
+  unsigned long number = 0;
+
+  int capacity = 0;
+
+  for (;;) {
+    int n = 1;
+
+    for (struct Subscriber *s = subscribers; s; s = s->next) ++n;
+
+    if (n > capacity) {
+      capacity = n * 2;
+      fds = (struct pollfd*)realloc(fds, capacity * sizeof(struct pollfd));
+    }
+
+    fds[0] = (struct pollfd) { p->wake, POLLIN, 0 };
+
+    n = 1;
+
+    for (struct Subscriber *s = subscribers; s; s = s->next)
+      fds[n++] = (struct pollfd) { s->fd, s->count ? POLLOUT : 0, 0 };
+
+    if (poll(fds, n, -1) < 0) continue;
+
+    n = 1;
+
+    for (struct Subscriber *s = subscribers; s; s = s->next)
+      s->hangup = fds[n++].revents & (POLLERR | POLLHUP);
+
+    if (fds[0].revents & POLLIN) {
+      uint64_t count;
+
+      read(p->wake, &count, sizeof(count));
+
+      for (struct Subscriber *s = atomic_exchange(&p->joining, NULL), *next; s; s = next) {
+        next = s->next;
+        s->next = subscribers;
+        subscribers = s;
+      }
+
+      atomic_store(&p->active[READERS], atomic_load(&p->epoch));
+
+      struct Snapshot *snapshot = atomic_load(&p->current);
+
+      struct Encoded *frame = NULL, *diff = NULL;
+
+      if (snapshot && snapshot->number != number && (frame = snapshot_frame(snapshot))) {
+        atomic_fetch_add(&frame->refs, 1);
+        number = snapshot->number;
+      }
+
+      atomic_store(&p->active[READERS], 0);
+
+      if (frame) {
+        diff = last ? frame_diff(last, frame) : NULL;
+
+        if (last) encoded_release(last);
+
+        last = frame;
+      }
+
+      for (struct Subscriber *s = subscribers; s; s = s->next) {
+        if (frame) {
+          if (diff && !s->key && s->count < FANOUT_BACKLOG)
+            subscriber_queue(s, diff);
+          else
+            s->key = 1;
+        }
+
+        if (s->key && last) {
+          subscriber_skip(s);
+          subscriber_queue(s, last);
+          s->key = 0;
+        }
+      }
+
+      if (diff) encoded_release(diff);
+    }
+
+    for (struct Subscriber **link = &subscribers; *link;) {
+      struct Subscriber *s = *link;
+
+      if (!s->hangup && subscriber_flush(s)) {
+        link = &s->next;
+        continue;
+      }
+
+      *link = s->next;
+
+      s->offset = 0;
+      subscriber_skip(s);
+
+      close(s->fd);
+      slab_free(s, sizeof(struct Subscriber));
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Hand a connection over to the fan-out thread.
+ *
+ * @param p A pointer to a publisher.
+ * @param fd The connection.
+ */
+void subscribe(struct Publisher *p, int fd) {
+  struct Subscriber *s = (struct Subscriber*)slab_calloc(sizeof(struct Subscriber));
+
+  uint64_t one = 1;
+
+  if (!s) {
+    close(fd);
+    return;
+  }
+
+  s->fd = fd;
+  s->key = 1;
+  s->next = atomic_load(&p->joining);
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  while (!atomic_compare_exchange_weak(&p->joining, &s->next, s));
+
+  write(p->wake, &one, sizeof(one));
+}
+
+/*
+ * Answer a request with the latest published frame, or an error
+ * when nothing has been published yet.
+ *
+ * @param p A pointer to a publisher.
+ * @param slot The slot of the reader answering.
+ * @param v A pointer to the viewer.
+ * @return Whether or not there was memory for the answer.
+ */
+int viewer_answer(struct Publisher *p, int slot, struct Viewer *v) {
+  atomic_store(&p->active[slot], atomic_load(&p->epoch));
+
+  struct Snapshot *s = atomic_load(&p->current);
+
+  struct Encoded *frame = s ? snapshot_frame(s) : NULL;
+
+  if (frame) {
+    atomic_fetch_add(&frame->refs, 1);
+    count(&counters()->frames, 1);
+  }
+
+  atomic_store(&p->active[slot], 0);
+
+  if (!frame && !s) frame = encode("ERROR", "error: Nothing has been displayed\n", 34);
+
+  if (!frame) return 0;
+
+  v->pending = frame;
+  v->offset = frame->header;
+
+  return 1;
+}
+
+/*
+ * Write as much of a viewer's pending answer as its connection
+ * takes without blocking.
+ *
+ * @param v A pointer to the viewer.
+ * @return Whether or not the connection is still usable.
+ */
+int viewer_flush(struct Viewer *v) {
+  while (v->pending) {
+    ssize_t written = write(v->fd, v->pending->data + v->offset, v->pending->size - v->offset);
+
+    if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+    if (written <= 0) return 0;
+
+    count(&counters()->bytes, written);
+
+    if ((v->offset += written) < v->pending->size) continue;
+
+    encoded_release(v->pending);
+    v->pending = NULL;
+  }
+
+  return 1;
+}
+
+/*
+ * Answer every line a viewer has sent until its connection has
+ * nothing more to read or can't take more of an answer. A viewer
+ * that asks to `SUBSCRIBE` is handed over to the fan-out thread.
+ *
+ * @param p A pointer to a publisher.
+ * @param slot The slot of the reader serving the viewer.
+ * @param v A pointer to the viewer.
+ * @return The events to wait for next, or 0 when the reader is
+ *         done with the viewer.
+ */
+uint32_t viewer_run(struct Publisher *p, int slot, struct Viewer *v) {
+  for (;;) {
+    if (!viewer_flush(v)) return 0;
+
+    if (v->pending) return EPOLLOUT;
+
+    char *end = (char*)memchr(v->line, '\n', v->length);
+
+    if (end || v->length == sizeof(v->line)) {
+      size_t n = end ? (size_t)(end - v->line) + 1 : v->length;
+
+      if (n >= 9 && !strncasecmp(v->line, "SUBSCRIBE", 9)) {
+        epoll_ctl(p->epoll, EPOLL_CTL_DEL, v->fd, NULL);
+        subscribe(p, v->fd);
+        v->fd = -1;
+        return 0;
+      }
+
+      memmove(v->line, v->line + n, v->length - n);
+      v->length -= n;
+
+      if (!viewer_answer(p, slot, v)) return 0;
+      continue;
+    }
+
+    ssize_t n = read(v->fd, v->line + v->length, sizeof(v->line) - v->length);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return EPOLLIN;
+    if (n <= 0) return 0;
+
+    v->length += n;
+  }
+}
+
+/*
+ * Accept every pending connection as a new viewer.
+ *
+ * @param p A pointer to a publisher.
+ */
+void viewers_accept(struct Publisher *p) {
+  int fd;
+
+  while ((fd = accept4(p->listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+    struct Viewer *v = (struct Viewer*)slab_calloc(sizeof(struct Viewer));
+
+    if (!v) {
+      close(fd);
+      continue;
+    }
+
+    v->fd = fd;
+
+    struct epoll_event e = { EPOLLIN | EPOLLONESHOT, { .ptr = v } };
+
+    epoll_ctl(p->epoll, EPOLL_CTL_ADD, fd, &e);
+  }
+}
+
+/*
+ * The body of a reader thread, which serves whichever viewer is
+ * ready next, answering every line it sends with the latest
+ * published frame.
+ *
+ * Viewers are registered one-shot, so each is only ever served
+ * by one reader at a time, and a viewer that sends nothing
+ * doesn't hold on to a reader.
+ *
+ * @param arg A pointer to a reader struct.
+ */
+void *reader_thread(void *arg) {
+  struct Reader *reader = (struct Reader*)arg;
+  struct Publisher *p = reader->publisher;
+
+  for (;;) {
+    struct epoll_event e;
+
+    if (epoll_wait(p->epoll, &e, 1, -1) <= 0) continue;
+
+    if (!e.data.ptr) {
+      viewers_accept(p);
+
+      e = (struct epoll_event) { EPOLLIN | EPOLLONESHOT, { .ptr = NULL } };
+      epoll_ctl(p->epoll, EPOLL_CTL_MOD, p->listener, &e);
+      continue;
+    }
+
+    struct Viewer *v = (struct Viewer*)e.data.ptr;
+
+    uint32_t events = viewer_run(p, reader->slot, v);
+
+    if (!events) {
+      if (v->pending) encoded_release(v->pending);
+      if (v->fd >= 0) close(v->fd);
+      slab_free(v, sizeof(struct Viewer));
+      continue;
+    }
+
+    e.events = events | EPOLLONESHOT;
+    epoll_ctl(p->epoll, EPOLL_CTL_MOD, v->fd, &e);
+  }
+
+  return NULL;
+}
+
+/*
+ * Listen on a Unix socket, replacing whatever was at its path.
+ *
+ * @param path The socket path.
+ * @return The listening socket, or -1.
+ */
+int listen_on(const char *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+  if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (
+    fd < 0 ||
+    bind(fd, (struct sockaddr*)&addr, sizeof(addr)) ||
+    listen(fd, 64)
+  ) return -1;
+
+  return fd;
+}
+
+/*
+ * Start serving published frames on a Unix socket.
+ *
+ * @param p A pointer to a publisher.
+ * @param path The socket path.
+ * @return Whether or not the socket could be set up.
+ */
+int publisher_init(struct Publisher *p, const char *path) {
+  if ((p->listener = listen_on(path)) < 0) return 0;
+
+  atomic_init(&p->current, NULL);
+  atomic_init(&p->epoch, 1);
+  atomic_init(&p->joining, NULL);
+
+  for (int i = 0; i <= READERS; ++i)
+    atomic_init(&p->active[i], 0);
+
+  p->retired = NULL;
+  p->published = 0;
+  p->wake = eventfd(0, 0);
+  p->epoll = epoll_create1(0);
+
+  fcntl(p->listener, F_SETFL, fcntl(p->listener, F_GETFL) | O_NONBLOCK);
+
+  struct epoll_event e = { EPOLLIN | EPOLLONESHOT, { .ptr = NULL } };
+
+  epoll_ctl(p->epoll, EPOLL_CTL_ADD, p->listener, &e);
+
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_t fanout;
+
+  pthread_create(&fanout, NULL, fanout_thread, p);
+  pthread_detach(fanout);
+
+  for (int i = 0; i < READERS; ++i) {
+    struct Reader *reader = (struct Reader*)malloc(sizeof(struct Reader));
+    pthread_t thread;
+
+    *reader = (struct Reader) { p, i };
+
+    pthread_create(&thread, NULL, reader_thread, reader);
+    pthread_detach(thread);
+  }
+
+  return 1;
+}
+
+/*
+ * The size of the buffer a recording is written through.
+ */
+#define RECORD_BUFFER 65536
+
+/*
+ * How often, in seconds, whatever a recording has buffered is
+ * written out.
+ */
+#define RECORD_LATENCY 0.5
+
+/*
+ * The widest run of unchanged cells a recorded diff writes over
+ * rather than moving the cursor past.
+ */
+#define RECORD_GAP 8
+
+/*
+ * Records every `DISPLAY` as an asciicast v2 stream. The first
+ * frame is drawn whole and the rest only as the spans of cells
+ * that changed, each after a cursor movement to where it starts.
+ *
+ * Frames are kept the way `DISPLAY` prints them, `rows` lines of
+ * `cols` bytes without their newlines. `lock` guards the buffer,
+ * which a timer thread writes out too.
+ */
+struct Recorder {
+  pthread_mutex_t lock;
+  int fd, started;
+  double start;
+  struct Rect clip;
+  int rows, cols;
+  char *last, *frame, *event;
+  char buffer[RECORD_BUFFER];
+  size_t size;
+} recorder;
+
+/*
+ * Write out whatever a recording has buffered, with its lock
+ * held.
+ *
+ * @param r A pointer to a recorder.
+ */
+void record_flush(struct Recorder *r) {
+  write_all(r->fd, r->buffer, r->size);
+
+  r->size = 0;
+}
+
+/*
+ * Append bytes to a recording, writing the buffer out when it
+ * fills up.
+ *
+ * @param r A pointer to a recorder.
+ * @param data The bytes.
+ * @param n The number of bytes.
+ */
+void record_write(struct Recorder *r, const char *data, size_t n) {
+  while (n) {
+    if (r->size == RECORD_BUFFER) record_flush(r);
+
+    size_t k = RECORD_BUFFER - r->size < n ? RECORD_BUFFER - r->size : n;
+
+    memcpy(r->buffer + r->size, data, k);
+
+    r->size += k;
+    data += k;
+    n -= k;
+  }
+}
+
+/*
+ * Append bytes to a recording as the inside of a JSON string.
+ * Other bytes outside of printable ASCII than line breaks are
+ * escaped as the code point of the same value.
+ *
+ * @param r A pointer to a recorder.
+ * @param data The bytes.
+ * @param n The number of bytes.
+ */
+void record_string(struct Recorder *r, const char *data, size_t n) {
+  size_t from = 0;
+
+  for (size_t k = 0; k < n; ++k) {
+    unsigned char c = data[k];
+
+    if (c >= ' ' && c < 0x7f && c != '"' && c != '\\') continue;
+
+    char escape[8];
+
+    int length =
+      c == '"' || c == '\\' ? snprintf(escape, sizeof(escape), "\\%c", c) :
+      c == '\r' ? snprintf(escape, sizeof(escape), "\\r") :
+      c == '\n' ? snprintf(escape, sizeof(escape), "\\n") :
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+
+    record_write(r, data + from, k - from);
+    record_write(r, escape, length);
+
+    from = k + 1;
+  }
+
+  record_write(r, data + from, n - from);
+}
+
+/*
+ * Append an event to a recording, stamped with the time since
+ * it started.
+ *
+ * @param r A pointer to a recorder.
+ * @param type The event type, `o` for output or `r` for a resize.
+ * @param data The event data.
+ * @param n The length of the event data.
+ */
+void record_event(struct Recorder *r, const char *type, const char *data, size_t n) {
+  char head[64];
+
+  pthread_mutex_lock(&r->lock);
+
+  record_write(r, head, snprintf(head, sizeof(head), "[%.6f, \"%s\", \"", now() - r->start, type));
+  record_string(r, data, n);
+  record_write(r, "\"]\n", 3);
+
+  pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * Append the header of a recording, sized for a terminal that
+ * fits frames of the given dimensions.
+ *
+ * @param r A pointer to a recorder.
+ * @param rows The number of lines in a frame.
+ * @param cols The number of bytes in each line.
+ */
+void record_header(struct Recorder *r, int rows, int cols) {
+  char header[160];
+
+  pthread_mutex_lock(&r->lock);
+
+  record_write(r, header, snprintf(
+    header,
+    sizeof(header),
+    "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %ld}\n",
+    cols,
+    rows + 1,
+    (long)time(NULL)
+  ));
+
+  r->started = 1;
+
+  pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * Record the visible region of the canvas as the next frame.
+ *
+ * When the region is the same as last time only the spans that
+ * changed are written, spans a few cells apart being joined when
+ * that's shorter than moving the cursor between them. Otherwise
+ * the terminal is resized, when need be, and the frame is drawn
+ * whole.
+ *
+ * @param r A pointer to a recorder.
+ * @param grid A pointer to a grid.
+ */
+void record(struct Recorder *r, struct Grid *grid) {
+  int wrap = 10;
+
+  struct Rect c = grid->clip;
+
+  int rows = c.y2 - c.y1 + 2, cols = c.x2 - c.x1 + 3,
+      whole = !r->rows || memcmp(&c, &r->clip, sizeof(c));
+
+  if (rows != r->rows || cols != r->cols) {
+    free(r->last);
+    free(r->frame);
+    free(r->event);
+
+    r->last = (char*)malloc((size_t)rows * cols);
+    r->frame = (char*)malloc((size_t)rows * cols);
+    r->event = (char*)malloc((size_t)rows * (cols * 4 + 32) + 32);
+
+    if (r->started) {
+      char size[32];
+      record_event(r, "r", size, snprintf(size, sizeof(size), "%dx%d", cols, rows + 1));
+    }
+
+    r->rows = rows;
+    r->cols = cols;
+
+    if (!r->started) record_header(r, rows, cols);
+  }
+
+  r->clip = c;
+
+  thaw(grid, c.y1, c.y2);
+
+  for (int i = c.y2; i >= c.y1; --i) {
+    char *line = r->frame + (size_t)(c.y2 - i) * cols;
+
+    line[0] = '0' + ((i - wrap) % wrap + wrap) % wrap;
+    line[1] = ' ';
+
+    unblank(line + 2, row(grid, i) + c.x1, cols - 2);
+  }
+
+  char *footer = r->frame + (size_t)(rows - 1) * cols;
+
+  footer[0] = ' ';
+
+  for (int i = c.x1; i <= c.x2; ++i)
+    footer[i - c.x1 + 1] = '0' + ((i - wrap) % wrap + wrap) % wrap;
+
+  footer[cols - 1] = ' ';
+
+  char *o = r->event;
+
+  if (whole) {
+    o += sprintf(o, "\x1b[H\x1b[2J");
+
+    for (int y = 0; y < rows; ++y) {
+      memcpy(o, r->frame + (size_t)y * cols, cols);
+      o += cols;
+      *o++ = '\r';
+      *o++ = '\n';
+    }
+  } else {
+    for (int y = 0; y < rows; ++y) {
+      const char *a = r->last + (size_t)y * cols, *b = r->frame + (size_t)y * cols;
+
+      for (int x = 0; x < cols;) {
+        if (a[x] == b[x]) {
+          ++x;
+          continue;
+        }
+
+        int end = x + 1;
+
+        for (int k = end; k < cols && k - end <= RECORD_GAP; ++k)
+          if (a[k] != b[k]) end = k + 1;
+
+        o += sprintf(o, "\x1b[%d;%dH", y + 1, x + 1);
+        memcpy(o, b + x, end - x);
+        o += end - x;
+
+        x = end;
+      }
+    }
+
+    if (o == r->event) return;
+
+    o += sprintf(o, "\x1b[%d;1H", rows + 1);
+  }
+
+  record_event(r, "o", r->event, o - r->event);
+
+  char *swap = r->last;
+
+  r->last = r->frame;
+  r->frame = swap;
+}
+
+/*
+ * The body of the thread writing out what a recording has
+ * buffered every `RECORD_LATENCY` seconds, so that it can be
+ * followed while frames trickle in.
+ *
+ * @param arg A pointer to a recorder.
+ */
+void *record_thread(void *arg) {
+  struct Recorder *r = (struct Recorder*)arg;
+
+  struct timespec tick = { 0, (long)(RECORD_LATENCY * 1e9) };
+
+  for (;;) {
+    nanosleep(&tick, NULL);
+
+    pthread_mutex_lock(&r->lock);
+
+    int done = r->fd < 0;
+
+    if (!done && r->size) record_flush(r);
+
+    pthread_mutex_unlock(&r->lock);
+
+    if (done) break;
+  }
+
+  return NULL;
+}
+
+/*
+ * Start recording to a file.
+ *
+ * @param r A pointer to a recorder.
+ * @param path The path of the recording.
+ * @return Whether or not the file could be created.
+ */
+int recorder_init(struct Recorder *r, const char *path) {
+  if ((r->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) return 0;
+
+  pthread_mutex_init(&r->lock, NULL);
+
+  r->started = 0;
+  r->start = now();
+  r->rows = r->cols = 0;
+  r->last = r->frame = r->event = NULL;
+  r->size = 0;
+
+  pthread_t thread;
+
+  pthread_create(&thread, NULL, record_thread, r);
+  pthread_detach(thread);
+
+  return 1;
+}
+
+/*
+ * Finish the recording, giving it a header if nothing was ever
+ * displayed, and write out what's left of it.
+ */
+void record_finish(void) {
+  if (!recorder.started) record_header(&recorder, 23, 80);
+
+  pthread_mutex_lock(&recorder.lock);
+
+  record_flush(&recorder);
+
+  close(recorder.fd);
+  recorder.fd = -1;
+
+  pthread_mutex_unlock(&recorder.lock);
+}
+
+/*
+ * Sum a counter over every thread.
+ *
+ * @param offset The offset of the counter in `struct Counters`.
+ * @return The sum.
+ */
+unsigned long counters_sum(size_t offset) {
+  unsigned long sum = 0;
+
+  for (struct Counters *c = atomic_load(&counters_list); c; c = c->next)
+    sum += atomic_load_explicit((atomic_ulong*)((char*)c + offset), memory_order_relaxed);
+
+  return sum;
+}
+
+/*
+ * The name of a command.
+ *
+ * @param cmd The command.
+ * @return Its name.
+ */
+const char *command_name(enum Command cmd) {
+  for (size_t i = 0; i < sizeof(COMMAND_STRING) / sizeof(COMMAND_STRING[0]); ++i)
+    if (COMMAND_STRING[i].command == cmd)
+      return COMMAND_STRING[i].str;
+
+  return "INVALID";
+}
+
+/*
+ * Write every metric in the Prometheus text format.
+ *
+ * @param f The stream to write to.
+ */
+void metrics_write(FILE *f) {
+  const char *queues[QUEUES] = { "display_list", "session", "subscribers" };
+
+  fprintf(f, "# HELP asciidraw_operations_total Operations evaluated.\n");
+  fprintf(f, "# TYPE asciidraw_operations_total counter\n");
+
+  for (int cmd = 0; cmd < COMMANDS; ++cmd)
+    fprintf(
+      f,
+      "asciidraw_operations_total{command=\"%s\"} %lu\n",
+      command_name(cmd),
+      counters_sum(offsetof(struct Counters, ops[cmd]))
+    );
+
+  fprintf(f, "# HELP asciidraw_operation_seconds Time spent evaluating operations.\n");
+  fprintf(f, "# TYPE asciidraw_operation_seconds histogram\n");
+
+  for (int cmd = 0; cmd < COMMANDS; ++cmd) {
+    unsigned long total = 0;
+
+    double bound = 1e-6;
+
+    for (int k = 0; k < LATENCY_BUCKETS; ++k, bound *= 10) {
+      char le[16];
+
+      total += counters_sum(offsetof(struct Counters, latency[cmd][k]));
+
+      if (k < LATENCY_BUCKETS - 1)
+        snprintf(le, sizeof(le), "%g", bound);
+      else
+        strcpy(le, "+Inf");
+
+      fprintf(
+        f,
+        "asciidraw_operation_seconds_bucket{command=\"%s\",le=\"%s\"} %lu\n",
+        command_name(cmd),
+        le,
+        total
+      );
+    }
+
+    fprintf(
+      f,
+      "asciidraw_operation_seconds_sum{command=\"%s\"} %.9f\n",
+      command_name(cmd),
+      counters_sum(offsetof(struct Counters, latency_ns[cmd])) / 1e9
+    );
+
+    fprintf(f, "asciidraw_operation_seconds_count{command=\"%s\"} %lu\n", command_name(cmd), total);
+  }
+
+  fprintf(f, "# HELP asciidraw_cells_written_total Cells drawn on.\n");
+  fprintf(f, "# TYPE asciidraw_cells_written_total counter\n");
+  fprintf(f, "asciidraw_cells_written_total %lu\n", counters_sum(offsetof(struct Counters, cells)));
+
+  fprintf(f, "# HELP asciidraw_frames_total Frames printed or sent to viewers.\n");
+  fprintf(f, "# TYPE asciidraw_frames_total counter\n");
+  fprintf(f, "asciidraw_frames_total %lu\n", counters_sum(offsetof(struct Counters, frames)));
+
+  fprintf(f, "# HELP asciidraw_bytes_out_total Bytes written to sockets and terminals.\n");
+  fprintf(f, "# TYPE asciidraw_bytes_out_total counter\n");
+  fprintf(f, "asciidraw_bytes_out_total %lu\n", counters_sum(offsetof(struct Counters, bytes)));
+
+  fprintf(f, "# HELP asciidraw_queue_depth Items waiting in a queue.\n");
+  fprintf(f, "# TYPE asciidraw_queue_depth gauge\n");
+
+  for (int q = 0; q < QUEUES; ++q)
+    fprintf(
+      f,
+      "asciidraw_queue_depth{queue=\"%s\"} %ld\n",
+      queues[q],
+      (long)(
+        counters_sum(offsetof(struct Counters, enqueued[q])) -
+        counters_sum(offsetof(struct Counters, dequeued[q]))
+      )
+    );
+
+  unsigned long hits = 0, misses = 0, pages = 0;
+
+  for (int k = 0; k < SLAB_CLASSES; ++k) {
+    hits += atomic_load(&slab_classes[k].hits);
+    misses += atomic_load(&slab_classes[k].misses);
+  }
+
+  FILE *statm = fopen("/proc/self/statm", "r");
+
+  if (statm) {
+    if (fscanf(statm, "%*s %lu", &pages) != 1) pages = 0;
+    fclose(statm);
+  }
+
+  fprintf(f, "# HELP asciidraw_resident_bytes Resident memory.\n");
+  fprintf(f, "# TYPE asciidraw_resident_bytes gauge\n");
+  fprintf(f, "asciidraw_resident_bytes %lu\n", pages * (unsigned long)sysconf(_SC_PAGESIZE));
+
+  fprintf(f, "# HELP asciidraw_slab_bytes Memory carved into slabs.\n");
+  fprintf(f, "# TYPE asciidraw_slab_bytes gauge\n");
+  fprintf(f, "asciidraw_slab_bytes %lu\n", atomic_load(&slab_slabs) * SLAB_SIZE);
+
+  fprintf(f, "# HELP asciidraw_memory_bytes Memory held, by part of the interpreter.\n");
+  fprintf(f, "# TYPE asciidraw_memory_bytes gauge\n");
+
+  for (int k = 0; k < MEMORY_KINDS; ++k)
+    fprintf(
+      f,
+      "asciidraw_memory_bytes{subsystem=\"%s\"} %ld\n",
+      MEMORY_NAMES[k],
+      atomic_load(&memory_use[k].current)
+    );
+
+  fprintf(f, "# HELP asciidraw_memory_peak_bytes The most memory ever held, by part of the interpreter.\n");
+  fprintf(f, "# TYPE asciidraw_memory_peak_bytes gauge\n");
+
+  for (int k = 0; k < MEMORY_KINDS; ++k)
+    fprintf(
+      f,
+      "asciidraw_memory_peak_bytes{subsystem=\"%s\"} %ld\n",
+      MEMORY_NAMES[k],
+      atomic_load(&memory_use[k].peak)
+    );
+
+  fprintf(f, "# HELP asciidraw_slab_allocations_total Slab allocations, by whether the thread cache had a block or had to refill.\n");
+  fprintf(f, "# TYPE asciidraw_slab_allocations_total counter\n");
+  fprintf(f, "asciidraw_slab_allocations_total{source=\"cache\"} %lu\n", hits);
+  fprintf(f, "asciidraw_slab_allocations_total{source=\"refill\"} %lu\n", misses);
+}
+
+/*
+ * The body of the thread answering metrics scrapes, each with a
+ * plain HTTP response.
+ *
+ * @param arg The listening socket.
+ */
+void *metrics_thread(void *arg) {
+  int listener = (int)(intptr_t)arg;
+
+  for (;;) {
+    int fd = accept(listener, NULL, NULL);
+
+    if (fd < 0) continue;
+
+    struct pollfd request = { fd, POLLIN, 0 };
+
+    char discard[4096];
+
+    if (poll(&request, 1, 100) > 0) read(fd, discard, sizeof(discard));
+
+    char *body = NULL, header[128];
+    size_t size = 0;
+
+    FILE *f = open_memstream(&body, &size);
+
+    metrics_write(f);
+    fclose(f);
+
+    int h = snprintf(
+      header,
+      sizeof(header),
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: %zu\r\n\r\n",
+      size
+    );
+
+    write_all(fd, header, h);
+    write_all(fd, body, size);
+
+    free(body);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+/*
+ * Serve metrics on a Unix socket, or on a localhost port when
+ * given a number.
+ *
+ * @param where The socket path or port.
+ * @return Whether or not the socket could be set up.
+ */
+int metrics(const char *where) {
+  int fd;
+
+  if (where[strspn(where, "0123456789")]) {
+    fd = listen_on(where);
+  } else {
+    struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(atoi(where)),
+      .sin_addr = { htonl(INADDR_LOOPBACK) }
+    };
+
+    int reuse = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (
+      fd < 0 ||
+      bind(fd, (struct sockaddr*)&addr, sizeof(addr)) ||
+      listen(fd, 64)
+    ) fd = -1;
+  }
+
+  if (fd < 0) return 0;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_t thread;
+
+  pthread_create(&thread, NULL, metrics_thread, (void*)(intptr_t)fd);
+  pthread_detach(thread);
+
+  return 1;
+}
+
+/*
+ * The time between profiler samples, in microseconds of CPU
+ * time used by the process.
+ */
+#define PROFILE_INTERVAL 1000
+
+/*
+ * The deepest stack the profiler records, further frames are
+ * left out of samples.
+ */
+#define PROFILE_DEPTH 16
+
+/*
+ * The number of distinct stacks the profiler can tell apart,
+ * a power of two.
+ */
+#define PROFILE_SLOTS 4096
+
+/*
+ * A frame of the profiled stack, either a script line or, with
+ * no line, a command or the handler running it.
+ */
+struct Frame {
+  const char *name;
+  int line;
+};
+
+/*
+ * A distinct stack seen by the profiler and how many samples
+ * landed in it. Slots are claimed from the signal handler, so
+ * their state goes from empty to being written to ready.
+ */
+struct Sample {
+  atomic_int state;
+  int depth;
+  struct Frame frames[PROFILE_DEPTH];
+  atomic_ulong count;
+};
+
+/*
+ * A script path recorded by the profiler, kept until the report
+ * since the module it came from may be freed before then.
+ */
+struct ProfileName {
+  char *name;
+  struct ProfileName *next;
+};
+
+/*
+ * The sampling profiler. The stack is kept by the interpreter
+ * thread and read by whichever thread a `SIGPROF` lands on, so
+ * time spent by the pool on behalf of an operation is charged
+ * to it as well.
+ */
+struct Profiler {
+  int enabled;
+  const char *path;
+  struct ProfileName *names;
+  volatile int depth;
+  struct Frame stack[PROFILE_DEPTH];
+  struct Sample *samples;
+  struct timespec start;
+  atomic_ulong total;
+  atomic_ulong dropped;
+} profiler;
+
+/*
+ * Find the profiler's own copy of a script path, making one the
+ * first time it is seen. The most recent path is checked first,
+ * as consecutive lines mostly come from the same script.
+ *
+ * @param name The script path.
+ * @return The copy, or the path itself if it can't be made.
+ */
+const char *profile_name(const char *name) {
+  struct ProfileName **link = &profiler.names;
+
+  for (; *link; link = &(*link)->next)
+    if (!strcmp((*link)->name, name)) break;
+
+  struct ProfileName *n = *link;
+
+  if (n) {
+    *link = n->next;
+  } else {
+    n = (struct ProfileName*)malloc(sizeof(struct ProfileName));
+
+    if (!n) return name;
+
+    if (!(n->name = strdup(name))) {
+      free(n);
+      return name;
+    }
+  }
+
+  n->next = profiler.names;
+  profiler.names = n;
+
+  return n->name;
+}
+
+/*
+ * Push a frame onto the profiled stack, if profiling. Script
+ * paths are recorded by copy, so samples outlive their modules.
+ *
+ * @param name The script path, command or handler.
+ * @param line The script line, or 0.
+ */
+void profile_enter(const char *name, int line) {
+  if (!profiler.enabled) return;
+
+  if (line) name = profile_name(name);
+
+  int depth = profiler.depth;
+
+  if (depth < PROFILE_DEPTH) profiler.stack[depth] = (struct Frame) { name, line };
+
+  atomic_signal_fence(memory_order_release);
+
+  profiler.depth = depth + 1;
+}
+
+/*
+ * Pop the innermost frame of the profiled stack, if profiling.
+ */
+void profile_leave(void) {
+  if (profiler.enabled) --profiler.depth;
+}
+
+/*
+ * Run a handler under a frame of its own.
+ */
+#define PROFILE(name, call) do { profile_enter(name, 0); call; profile_leave(); } while (0)
+
+/*
+ * Record a sample of the profiled stack. This runs in a signal
+ * handler, so it only touches memory set aside beforehand.
+ *
+ * @param sig The signal number.
+ */
+void profile_sample(int sig) {
+  (void)sig;
+
+  struct Frame frames[PROFILE_DEPTH];
+
+  int depth = profiler.depth;
+
+  atomic_signal_fence(memory_order_acquire);
+
+  if (depth > PROFILE_DEPTH) depth = PROFILE_DEPTH;
+  if (depth < 0) depth = 0;
+
+  uint64_t hash = 1469598103934665603ull;
+
+  for (int k = 0; k < depth; ++k) {
+    frames[k] = profiler.stack[k];
+    hash = (hash ^ (uintptr_t)frames[k].name) * 1099511628211ull;
+    hash = (hash ^ (unsigned)frames[k].line) * 1099511628211ull;
+  }
+
+  atomic_fetch_add_explicit(&profiler.total, 1, memory_order_relaxed);
+
+  for (int probe = 0; probe < PROFILE_SLOTS; ++probe) {
+    struct Sample *s = &profiler.samples[(hash + probe) & (PROFILE_SLOTS - 1)];
+
+    int state = atomic_load_explicit(&s->state, memory_order_acquire);
+
+    if (!state && atomic_compare_exchange_strong(&s->state, &state, 1)) {
+      s->depth = depth;
+      memcpy(s->frames, frames, sizeof(struct Frame) * depth);
+      atomic_fetch_add_explicit(&s->count, 1, memory_order_relaxed);
+      atomic_store_explicit(&s->state, 2, memory_order_release);
+      return;
+    }
+
+    if (
+      state == 2 &&
+      s->depth == depth &&
+      !memcmp(s->frames, frames, sizeof(struct Frame) * depth)
+    ) {
+      atomic_fetch_add_explicit(&s->count, 1, memory_order_relaxed);
+      return;
+    }
+  }
+
+  atomic_fetch_add_explicit(&profiler.dropped, 1, memory_order_relaxed);
+}
+
+/*
+ * A script line of the flat profile and the samples spent on it.
+ */
+struct ProfileLine {
+  const char *name;
+  int line;
+  const char *cmd;
+  unsigned long count;
+};
+
+/*
+ * Order flat profile lines by where they are, for merging.
+ */
+int profile_by_line(const void *a, const void *b) {
+  const struct ProfileLine *x = (const struct ProfileLine*)a, *y = (const struct ProfileLine*)b;
+
+  if (x->name != y->name) return x->name ? (y->name ? strcmp(x->name, y->name) : 1) : -1;
+
+  return (x->line > y->line) - (x->line < y->line);
+}
+
+/*
+ * Order flat profile lines by how many samples they took, most
+ * first.
+ */
+int profile_by_count(const void *a, const void *b) {
+  const struct ProfileLine *x = (const struct ProfileLine*)a, *y = (const struct ProfileLine*)b;
+
+  return (x->count < y->count) - (x->count > y->count);
+}
+
+/*
+ * Stop the profiler, write its stacks in the folded format taken
+ * by flamegraph tools and report the lines that took the most
+ * samples on standard error.
+ */
+void profile_report(void) {
+  struct itimerval stop = { { 0, 0 }, { 0, 0 } };
+
+  setitimer(ITIMER_PROF, &stop, NULL);
+
+  FILE *f = fopen(profiler.path, "w");
+
+  if (!f) fprintf(stderr, "error: Can't create `%s`\n", profiler.path);
+
+  struct ProfileLine *lines = (struct ProfileLine*)malloc(sizeof(struct ProfileLine) * PROFILE_SLOTS);
+
+  int n = 0;
+
+  for (int k = 0; k < PROFILE_SLOTS; ++k) {
+    struct Sample *s = &profiler.samples[k];
+
+    if (atomic_load(&s->state) != 2) continue;
+
+    unsigned long count = atomic_load(&s->count);
+
+    struct ProfileLine line = { s->depth ? s->frames[0].name : NULL, 0, "", count };
+
+    for (int j = 0; j < s->depth; ++j) {
+      if (f) {
+        if (s->frames[j].line)
+          fprintf(f, "%s%s:%d", j ? ";" : "", s->frames[j].name, s->frames[j].line);
+        else
+          fprintf(f, "%s%s", j ? ";" : "", s->frames[j].name);
+      }
+
+      if (s->frames[j].line) {
+        line.name = s->frames[j].name;
+        line.line = s->frames[j].line;
+        line.cmd = j + 1 < s->depth && !s->frames[j + 1].line ? s->frames[j + 1].name : "";
+      }
+    }
+
+    if (f) fprintf(f, "%s %lu\n", s->depth ? "" : "(other)", count);
+
+    lines[n++] = line;
+  }
+
+  if (f) fclose(f);
+
+  qsort(lines, n, sizeof(struct ProfileLine), profile_by_line);
+
+  int merged = 0;
+
+  for (int k = 0; k < n; ++k)
+    if (merged && !profile_by_line(&lines[merged - 1], &lines[k]))
+      lines[merged - 1].count += lines[k].count;
+    else
+      lines[merged++] = lines[k];
+
+  qsort(lines, merged, sizeof(struct ProfileLine), profile_by_count);
+
+  unsigned long total = atomic_load(&profiler.total);
+
+  struct timespec end;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+
+  fprintf(
+    stderr,
+    "profile: %lu samples over %.3fs of CPU time, %lu dropped\n",
+    total,
+    (end.tv_sec - profiler.start.tv_sec) + (end.tv_nsec - profiler.start.tv_nsec) / 1e9,
+    atomic_load(&profiler.dropped)
+  );
+
+  for (int k = 0; k < merged && k < 20; ++k) {
+    if (lines[k].line)
+      fprintf(
+        stderr,
+        "%8lu %5.1f%%  %s:%d %s\n",
+        lines[k].count,
+        100.0 * lines[k].count / (total ? total : 1),
+        lines[k].name,
+        lines[k].line,
+        lines[k].cmd
+      );
+    else
+      fprintf(
+        stderr,
+        "%8lu %5.1f%%  %s\n",
+        lines[k].count,
+        100.0 * lines[k].count / (total ? total : 1),
+        lines[k].name ? lines[k].name : "(other)"
+      );
+  }
+
+  free(lines);
+}
+
+/*
+ * Start sampling the process, reporting once it exits.
+ *
+ * @param path Where to write the folded stacks.
+ */
+void profile(const char *path) {
+  struct sigaction action = { 0 };
+
+  profiler.path = path;
+  profiler.samples = (struct Sample*)calloc(PROFILE_SLOTS, sizeof(struct Sample));
+  profiler.enabled = 1;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &profiler.start);
+
+  action.sa_handler = profile_sample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+
+  atexit(profile_report);
+
+  struct itimerval timer = {
+    { PROFILE_INTERVAL / 1000000, PROFILE_INTERVAL % 1000000 },
+    { PROFILE_INTERVAL / 1000000, PROFILE_INTERVAL % 1000000 }
+  };
+
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/*
+ * The line parser responsible for turning lines read
+ * from standard input into valid `Operation` structs.
+ */
+struct Parser {
+  char line[LINE_MAX];
+};
+
+/*
+ * Read a line in from standard input and set it on the
+ * passed in parser.
+ *
+ * @param parser A pointer to a parser.
+ */
+void read_line(struct Parser *parser) {
+  fgets(parser->line, LINE_MAX, stdin);
+  parser->line[strcspn(parser->line, "\n")] = 0;
+}
+
+/*
+ * Walks the structural characters of script text, the newlines,
+ * carriage returns, spaces and commas that separate its tokens.
+ *
+ * The text is classified 64 bytes at a time into a bitmap of
+ * where those characters are, and tokens are the runs between
+ * consecutive set bits. `strings` tallies the bytes of names
+ * and paths handed out, for accounting once the scan is over.
+ */
+struct Scanner {
+  const char *data;
+  size_t length;
+  size_t base;
+  uint64_t mask;
+  size_t at;
+  int line;
+  long strings;
+};
+
+/*
+ * Build the bitmap of structural characters in a block of text.
+ *
+ * @param p The start of the block.
+ * @param n The number of bytes left from there, of which at
+ *          most 64 are looked at.
+ * @return A bit for each structural byte of the block.
+ */
+uint64_t structural(const char *p, size_t n) {
+  uint64_t mask = 0;
+
+  size_t i = 0;
+
+#ifdef __SSE2__
+  if (n >= 64) {
+    __m128i newline = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    __m128i space = _mm_set1_epi8(' '), comma = _mm_set1_epi8(',');
+
+    for (; i < 64; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+      __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, cr)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, comma))
+      );
+      mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(hit) << i;
+    }
+
+    return mask;
+  }
+#endif
+
+  for (; i < n && i < 64; ++i)
+    if (p[i] == '\n' || p[i] == '\r' || p[i] == ' ' || p[i] == ',')
+      mask |= (uint64_t)1 << i;
+
+  return mask;
+}
+
+/*
+ * Start scanning a range of text.
+ *
+ * @param s A pointer to the scanner.
+ * @param data The text.
+ * @param begin Where to start, at the beginning of a line.
+ * @param end Where to stop.
+ */
+void scanner_init(struct Scanner *s, const char *data, size_t begin, size_t end) {
+  s->data = data;
+  s->length = end;
+  s->base = begin;
+  s->mask = begin < end ? structural(data + begin, end - begin) : 0;
+  s->at = begin;
+  s->line = 0;
+  s->strings = 0;
+}
+
+/*
+ * Find the next structural character.
+ *
+ * @param s A pointer to the scanner.
+ * @return Its position, or the end of the text if there are no
+ *         more.
+ */
+size_t scanner_next(struct Scanner *s) {
+  while (!s->mask) {
+    if (s->base + 64 >= s->length) return s->length;
+    s->base += 64;
+    s->mask = structural(s->data + s->base, s->length - s->base);
+  }
+
+  size_t p = s->base + __builtin_ctzll(s->mask);
+
+  s->mask &= s->mask - 1;
+
+  return p;
+}
+
+/*
+ * Decode an argument, which is either a number or the code of
+ * its first character.
+ *
+ * @param p The start of the argument.
+ * @param n Its length.
+ * @return The value of the argument.
+ */
+int argument(const char *p, size_t n) {
+  if (!isdigit((unsigned char)*p)) return (int)*p;
+
+  unsigned long long value = 0;
+
+  for (size_t i = 0; i < n && isdigit((unsigned char)p[i]); ++i)
+    value = value * 10 + (p[i] - '0');
+
+  return (int)value;
+}
+
+/*
+ * Read the next non-blank line of a scanner into an operation,
+ * numbering lines from the start of the scanner.
+ *
+ * The command is split from its arguments on spaces and the
+ * arguments from each other on spaces or commas. Anything past
+ * a carriage return is ignored.
+ *
+ * @param s A pointer to the scanner.
+ * @param op A pointer to the operation to fill in.
+ * @return Whether or not there was a line left.
+ */
+int tokenize(struct Scanner *s, struct Operation *op) {
+  while (s->at < s->length) {
+    size_t t = s->at, p;
+
+    int named = 0, index = 0;
+
+    *op = (struct Operation) { .cmd = INVALID };
+
+    for (;;) {
+      p = scanner_next(s);
+
+      char c = p < s->length ? s->data[p] : '\n';
+
+      if (!named) {
+        if (c == ',') continue;
+
+        if (p > t) {
+          named = 1;
+          op->name = strndup(s->data + t, p - t);
+          op->cmd = command_from_string(s->data + t, p - t);
+
+          s->strings += p - t + 1;
+
+          if (op->cmd == INCLUDE) {
+            size_t from = p + 1;
+
+            while (c != '\n' && c != '\r') {
+              p = scanner_next(s);
+              c = p < s->length ? s->data[p] : '\n';
+            }
+
+            size_t to = p > from ? p : from;
+
+            while (from < to && s->data[from] == ' ') ++from;
+            while (to > from && s->data[to - 1] == ' ') --to;
+
+            op->path = strndup(s->data + from, to - from);
+
+            s->strings += to - from + 1;
+          }
+        }
+      } else if (p > t && index < ARGS_MAX) {
+        op->args[index++] = argument(s->data + t, p - t);
+      }
+
+      t = p + 1;
+
+      if (c == '\r')
+        while ((p = scanner_next(s)) < s->length && s->data[p] != '\n');
+
+      if (c == '\r' || c == '\n') break;
+    }
+
+    s->at = p + 1;
+
+    op->line = ++s->line;
+
+    if (named) return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Parse the current string that's set on the passed
+ * in parser.
+ *
+ * @param parser A parser struct.
+ * @return The parsed operation, an invalid one with an empty
+ *         name for a blank line.
+ */
+struct Operation parse(struct Parser parser) {
+  struct Scanner s;
+
+  struct Operation operation;
+
+  scanner_init(&s, parser.line, 0, strlen(parser.line));
+
+  if (!tokenize(&s, &operation)) {
+    operation = (struct Operation) { .name = strdup(""), .cmd = INVALID };
+    s.strings = 1;
+  }
+
+  memory_add(MEMORY_PARSER, s.strings);
+
+  return operation;
+}
+
+/*
+ * Release the strings an operation owns.
+ *
+ * @param op A pointer to the operation.
+ */
+void operation_free(struct Operation *op) {
+  if (op->name) memory_add(MEMORY_PARSER, -(long)(strlen(op->name) + 1));
+  if (op->path) memory_add(MEMORY_PARSER, -(long)(strlen(op->path) + 1));
+
+  free(op->name);
+  free(op->path);
+
+  op->name = op->path = NULL;
+}
+
+/*
+ * The least number of bytes of a script worth tokenizing on a
+ * thread of its own, below which splitting costs more than it
+ * saves.
+ */
+#define SCRIPT_CHUNK (1 << 20)
+
+/*
+ * A script file tokenized ahead of time into the operations it
+ * runs, in order.
+ */
+struct Script {
+  struct Operation *ops;
+  size_t size;
+  const char *path;
+};
+
+/*
+ * The shared state of tokenizing a script, where each worker
+ * takes a chunk of the file that starts and ends on a line.
+ */
+struct Compile {
+  const char *data;
+  size_t length;
+  int chunks;
+  struct Operation **ops;
+  size_t *sizes;
+  int *lines;
+};
+
+/*
+ * Find where a chunk of a script begins, the start of the first
+ * line at or after its even share of the file.
+ *
+ * @param c A pointer to the compile state.
+ * @param k The chunk number, which may be one past the last.
+ * @return The offset of the chunk.
+ */
+size_t compile_offset(struct Compile *c, int k) {
+  if (k <= 0) return 0;
+  if (k >= c->chunks) return c->length;
+
+  size_t offset = (size_t)((unsigned long long)c->length * k / c->chunks);
+
+  const char *newline = (const char*)memchr(
+    c->data + offset - 1, '\n', c->length - offset + 1
+  );
+
+  return newline ? (size_t)(newline - c->data) + 1 : c->length;
+}
+
+/*
+ * Tokenize the lines of one chunk of a script into its own
+ * operation array. Blank lines are skipped.
+ *
+ * @param ctx A pointer to the compile state.
+ * @param worker The worker number, which is also the chunk.
+ */
+void compile_chunk(void *ctx, int worker) {
+  struct Compile *c = (struct Compile*)ctx;
+
+  if (worker >= c->chunks) return;
+
+  size_t at = compile_offset(c, worker), end = compile_offset(c, worker + 1);
+  size_t size = 0, capacity = 0;
+
+  struct Operation *ops = NULL;
+
+  struct Scanner s;
+
+  scanner_init(&s, c->data, at, end);
+
+  for (;;) {
+    if (size == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      ops = (struct Operation*)realloc(ops, sizeof(struct Operation) * capacity);
+    }
+
+    if (!tokenize(&s, &ops[size])) break;
+
+    ++size;
+  }
+
+  c->ops[worker] = ops;
+  c->sizes[worker] = size;
+  c->lines[worker] = s.line;
+
+  memory_add(MEMORY_PARSER, s.strings);
+}
+
+/*
+ * Tokenize script text into operations.
+ *
+ * The text is split into one chunk per worker of the pool, each
+ * tokenized on its own thread, and the results are joined back
+ * together in order. Small texts are left whole.
+ *
+ * @param pool A pointer to the pool to tokenize on, or `NULL`.
+ * @param data The text.
+ * @param length The length of the text.
+ * @param script A pointer to the script to fill in.
+ */
+void compile_text(struct Pool *pool, const char *data, size_t length, struct Script *script) {
+  int chunks = pool_workers(pool);
+
+  if (length / SCRIPT_CHUNK + 1 < (size_t)chunks)
+    chunks = (int)(length / SCRIPT_CHUNK + 1);
+
+  struct Compile c = {
+    .data = data,
+    .length = length,
+    .chunks = chunks,
+    .ops = (struct Operation**)calloc(chunks, sizeof(struct Operation*)),
+    .sizes = (size_t*)calloc(chunks, sizeof(size_t)),
+    .lines = (int*)calloc(chunks, sizeof(int))
+  };
+
+  if (chunks > 1) pool_run(pool, compile_chunk, &c);
+  else compile_chunk(&c, 0);
+
+  script->size = 0;
+
+  for (int k = 0; k < chunks; ++k) script->size += c.sizes[k];
+
+  script->ops = (struct Operation*)malloc(sizeof(struct Operation) * (script->size + 1));
+
+  memory_add(MEMORY_OPERATIONS, sizeof(struct Operation) * (script->size + 1));
+
+  size_t at = 0;
+
+  for (int k = 0, line = 0; k < chunks; line += c.lines[k], at += c.sizes[k++]) {
+    memcpy(script->ops + at, c.ops[k], sizeof(struct Operation) * c.sizes[k]);
+    free(c.ops[k]);
+
+    for (size_t j = at; j < at + c.sizes[k]; ++j) script->ops[j].line += line;
+  }
+
+  free(c.ops);
+  free(c.sizes);
+  free(c.lines);
+}
+
+/*
+ * Tokenize a script file into operations, mapping it rather
+ * than reading it in.
+ *
+ * @param pool A pointer to the pool to tokenize on, or `NULL`.
+ * @param path The script path.
+ * @param script A pointer to the script to fill in.
+ * @return Whether or not the script could be read.
+ */
+int compile(struct Pool *pool, const char *path, struct Script *script) {
+  int fd = open(path, O_RDONLY);
+
+  struct stat st;
+
+  *script = (struct Script) { .path = path };
+
+  if (fd < 0) return 0;
+
+  if (fstat(fd, &st)) {
+    close(fd);
+    return 0;
+  }
+
+  if (!st.st_size) {
+    close(fd);
+    return 1;
+  }
+
+  char *data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (data == MAP_FAILED) return 0;
+
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  compile_text(pool, data, st.st_size, script);
+
+  munmap(data, st.st_size);
+
+  return 1;
+}
+
+/*
+ * Release the operations of a script.
+ *
+ * @param script A pointer to the script.
+ */
+void script_free(struct Script *script) {
+  for (size_t k = 0; k < script->size; ++k) operation_free(&script->ops[k]);
+
+  if (script->ops) memory_add(MEMORY_OPERATIONS, -(long)(sizeof(struct Operation) * (script->size + 1)));
+
+  free(script->ops);
+  *script = (struct Script) { 0 };
+}
+
+/*
+ * How deeply scripts may include one another.
+ */
+#define INCLUDE_DEPTH 32
+
+/*
+ * A script fragment brought in by `INCLUDE`, tokenized once and
+ * kept for as long as the file it came from stays unchanged.
+ *
+ * Modules are shared between every interpreter of the process,
+ * so each one is counted by its users and freed by the last of
+ * them once a newer version has replaced it.
+ */
+struct Module {
+  char *path;
+  struct timespec mtime;
+  off_t size;
+  struct Script script;
+  atomic_int refs;
+  struct Module *next;
+};
+
+/*
+ * The modules of the process, by canonical path, so that a file
+ * reached through different relative paths or links is one.
+ */
+struct {
+  pthread_mutex_t lock;
+  struct Module *head;
+} modules = { PTHREAD_MUTEX_INITIALIZER, NULL };
+
+/*
+ * The canonical paths of the scripts being run on the calling
+ * thread, innermost last. A script given by path is at the bottom, below
+ * the modules it includes.
+ */
+__thread const char *including[INCLUDE_DEPTH];
+__thread int include_depth;
+
+/*
+ * Drop a reference to a module, freeing it with the last one.
+ *
+ * @param m A pointer to the module.
+ */
+void module_release(struct Module *m) {
+  if (atomic_fetch_sub_explicit(&m->refs, 1, memory_order_acq_rel) != 1) return;
+
+  script_free(&m->script);
+  free(m->path);
+  free(m);
+}
+
+/*
+ * Find where a module is linked into the list of the process.
+ * The modules lock must be held.
+ *
+ * @param path The canonical path of the file.
+ * @return The link to the module, pointing at `NULL` if there
+ *         is none.
+ */
+struct Module **module_find(const char *path) {
+  struct Module **link = &modules.head;
+
+  for (; *link; link = &(*link)->next)
+    if (!strcmp((*link)->path, path)) break;
+
+  return link;
+}
+
+/*
+ * Check whether a module was tokenized from the file as it is.
+ *
+ * @param m A pointer to the module.
+ * @param st The status of the file.
+ * @return Whether the module is up to date.
+ */
+int module_fresh(const struct Module *m, const struct stat *st) {
+  return
+    m->size == st->st_size &&
+    m->mtime.tv_sec == st->st_mtim.tv_sec &&
+    m->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * Find the module for a file, tokenizing it if it isn't known
+ * yet or has changed since it was.
+ *
+ * The lock isn't held while tokenizing, so another thread may
+ * have brought in the same file meanwhile, in which case its
+ * module is used if it is as fresh and replaced otherwise.
+ *
+ * @param path The canonical path of the file.
+ * @return A reference to the module, or `NULL` if the file
+ *         can't be read.
+ */
+struct Module *module_get(const char *path) {
+  struct stat st;
+
+  if (stat(path, &st)) return NULL;
+
+  pthread_mutex_lock(&modules.lock);
+
+  struct Module **link = module_find(path);
+  struct Module *m = *link;
+
+  if (m && module_fresh(m, &st)) {
+    atomic_fetch_add_explicit(&m->refs, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&modules.lock);
+    return m;
+  }
+
+  if (m) {
+    *link = m->next;
+    module_release(m);
+  }
+
+  pthread_mutex_unlock(&modules.lock);
+
+  m = (struct Module*)calloc(1, sizeof(struct Module));
+
+  if (!m) return NULL;
+
+  if (!compile(NULL, path, &m->script)) {
+    free(m);
+    return NULL;
+  }
+
+  if (!(m->path = strdup(path))) {
+    script_free(&m->script);
+    free(m);
+    return NULL;
+  }
+
+  m->script.path = m->path;
+  m->mtime = st.st_mtim;
+  m->size = st.st_size;
+
+  atomic_init(&m->refs, 2);
+
+  pthread_mutex_lock(&modules.lock);
+
+  link = module_find(path);
+
+  struct Module *other = *link;
+
+  if (other && module_fresh(other, &st)) {
+    atomic_fetch_add_explicit(&other->refs, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&modules.lock);
+
+    atomic_init(&m->refs, 1);
+    module_release(m);
+
+    return other;
+  }
+
+  if (other) {
+    *link = other->next;
+    module_release(other);
+  }
+
+  m->next = modules.head;
+  modules.head = m;
+
+  pthread_mutex_unlock(&modules.lock);
+
+  return m;
+}
+
+/*
+ * Start running an included script on the calling thread.
+ *
+ * Relative paths are taken from the directory of the script
+ * doing the including, or the working directory when that is
+ * standard input.
+ *
+ * @param path The path given to `INCLUDE`.
+ * @return The module to run, to be passed to `include_leave`
+ *         afterwards, or `NULL` if it can't be.
+ */
+struct Module *include_enter(const char *path) {
+  if (!path || !*path) {
+    fprintf(out(), "error: INCLUDE needs a path\n");
+    return NULL;
+  }
+
+  if (include_depth == INCLUDE_DEPTH) {
+    fprintf(out(), "error: Includes are nested too deeply at `%s`\n", path);
+    return NULL;
+  }
+
+  char resolved[PATH_MAX], canonical[PATH_MAX];
+
+  const char *parent = include_depth ? including[include_depth - 1] : NULL;
+  const char *slash = parent ? strrchr(parent, '/') : NULL;
+
+  if (*path != '/' && slash)
+    snprintf(resolved, sizeof(resolved), "%.*s/%s", (int)(slash - parent), parent, path);
+  else
+    snprintf(resolved, sizeof(resolved), "%s", path);
+
+  if (!realpath(resolved, canonical)) {
+    fprintf(out(), "error: Can't open `%s`\n", path);
+    return NULL;
+  }
+
+  for (int k = 0; k < include_depth; ++k)
+    if (!strcmp(including[k], canonical)) {
+      fprintf(out(), "error: `%s` includes itself\n", path);
+      return NULL;
+    }
+
+  struct Module *m = module_get(canonical);
+
+  if (!m) {
+    fprintf(out(), "error: Can't open `%s`\n", path);
+    return NULL;
+  }
+
+  including[include_depth++] = m->path;
+
+  return m;
+}
+
+/*
+ * Finish running an included script.
+ *
+ * @param m A pointer to the module.
+ */
+void include_leave(struct Module *m) {
+  --include_depth;
+  module_release(m);
+}
+
+/*
+ * The struct responsible for evaluating operations
+ * parsed by the parser.
+ */
+struct Interpreter {
+  struct Grid grid;
+  struct Operation op;
+  struct DisplayList list;
+  struct TileCache tiles;
+  struct Publisher *publisher;
+  struct Recorder *recorder;
+};
+
+/*
+ * Load an operation onto the passed in interpreter.
+ *
+ * @param i A pointer to an interpreter.
+ * @param op An operation struct.
+ */
+void load(struct Interpreter *i, struct Operation op) {
+  i->op = op;
+}
+
+/*
+ * Evaluate the operation that's present on the passed in
+ * interpreter.
+ *
+ * This method essentially associates commands with their
+ * corresponding methods on `Grid`. Drawing commands are only
+ * recorded on the display list, they are rasterized once
+ * something needs to be shown.
+ *
+ * @param i A pointer to an interpreter.
+ */
+void eval(struct Interpreter *i) {
+  double start = now();
+
+  profile_enter(command_name(i->op.cmd), 0);
+
+  switch (i->op.cmd) {
+    case CHAR:
+      PROFILE("character", character(&i->grid, i->op.args));
+      break;
+    case CIRCLE:
+    case LINE:
+    case POINT:
+    case RECTANGLE:
+      if (!i->grid.initialized) {
+        fprintf(out(), "error: Grid isn't initialized\n");
+        break;
+      }
+      PROFILE("push", push(&i->list, i->grid, i->op));
+      break;
+    case CLEAR:
+      count(&counters()->dequeued[QUEUE_DISPLAY_LIST], i->list.size);
+      i->list.size = 0;
+      PROFILE("clear", clear(&i->grid));
+      break;
+    case DISPLAY:
+      PROFILE("flush", flush(&i->grid, &i->list));
+      PROFILE("display", display(i->grid));
+      if (i->publisher && i->grid.initialized) PROFILE("publish", publish(i->publisher, &i->grid));
+      if (i->recorder && i->grid.initialized) PROFILE("record", record(i->recorder, &i->grid));
+      break;
+    case END:
+      observe(END, now() - start);
+      exit(0);
+    case GRID:
+      PROFILE("grid", grid(&i->grid, i->op.args));
+      break;
+    case INCLUDE: {
+      struct Module *m = include_enter(i->op.path);
+
+      if (!m) break;
+
+      struct Operation op = i->op;
+
+      for (size_t k = 0; k < m->script.size && m->script.ops[k].cmd != END; ++k) {
+        load(i, m->script.ops[k]);
+        profile_enter(m->path, m->script.ops[k].line);
+        eval(i);
+        profile_leave();
+      }
+
+      include_leave(m);
+
+      i->op = op;
+      break;
+    }
+    case INVALID:
+      fprintf(out(), "error: Invalid command `%s`\n", i->op.name);
+      break;
+    case MEMORY:
+      PROFILE("memory", memory_stats());
+      break;
+    case STATS:
+      PROFILE("stats", stats(&i->grid));
+      break;
+    case VIEW:
+      PROFILE("view", view(&i->grid, &i->list, i->op.args));
+      break;
+    case VIEWER:
+      PROFILE("flush", flush(&i->grid, &i->list));
+      PROFILE("viewer", viewer(&i->grid, &i->tiles));
+      break;
+    case ZOOM:
+      PROFILE("flush", flush(&i->grid, &i->list));
+      PROFILE("zoom", zoom(&i->grid, i->op.args));
+      break;
+  }
+
+  PROFILE("freeze", freeze(&i->grid, i->list.seq));
+
+  profile_leave();
+
+  observe(i->op.cmd, now() - start);
+}
+
+/*
+ * Release everything an interpreter holds, leaving it as it was
+ * before its first operation.
+ *
+ * @param i A pointer to an interpreter.
+ */
+void interpreter_free(struct Interpreter *i) {
+  grid_free(&i->grid);
+
+  count(&counters()->dequeued[QUEUE_DISPLAY_LIST], i->list.size);
+
+  slab_free(i->list.items, sizeof(struct Primitive) * i->list.capacity);
+
+  memory_add(MEMORY_OPERATIONS, -(long)(sizeof(struct Primitive) * i->list.capacity));
+
+  if (i->tiles.tiles)
+    memory_add(MEMORY_CACHES, -(long)((sizeof(struct CachedTile) + sizeof(int) * 2) * VIEWER_CACHE));
+
+  free(i->tiles.tiles);
+  free(i->tiles.buckets);
+
+  i->grid.character = '*';
+  i->list = (struct DisplayList) { 0 };
+  i->tiles = (struct TileCache) { 0 };
+}
+
+/*
+ * Run the operations of a script up to its end, with the script
+ * at the bottom of the include stack so that what it includes is
+ * found relative to it.
+ *
+ * @param i A pointer to an interpreter.
+ * @param script A pointer to the script.
+ */
+void run(struct Interpreter *i, struct Script *script) {
+  int bottom = script->path && include_depth < INCLUDE_DEPTH;
+
+  char canonical[PATH_MAX];
+
+  if (bottom)
+    including[include_depth++] = realpath(script->path, canonical) ? canonical : script->path;
+
+  for (size_t k = 0; k < script->size; ++k) {
+    if (script->ops[k].cmd == END) break;
+    load(i, script->ops[k]);
+    profile_enter(script->path, script->ops[k].line);
+    eval(i);
+    profile_leave();
+  }
+
+  if (bottom) --include_depth;
+}
+
+/*
+ * The kinds of messages client threads send to the session.
+ */
+enum MessageKind { MESSAGE_JOIN, MESSAGE_LEAVE, MESSAGE_OP };
+
+/*
+ * A message on the session queue.
+ */
+struct Message {
+  _Atomic(struct Message*) next;
+  enum MessageKind kind;
+  struct Client *client;
+  struct Operation op;
+};
+
+/*
+ * A lock-free queue that many client threads push messages
+ * onto and a single thread pops them off of, in the order
+ * their pushes took effect.
+ *
+ * Producers swap themselves in at `head`, the consumer walks
+ * from `tail`. `ready` counts the messages pushed so the
+ * consumer can sleep while the queue is empty.
+ */
+struct Queue {
+  _Atomic(struct Message*) head;
+  struct Message *tail;
+  struct Message stub;
+  sem_t ready;
+};
+
+/*
+ * The state shared by a session's threads.
+ */
+struct Session {
+  struct Queue queue;
+  int listener;
+};
+
+/*
+ * A client connected to a shared session. Only the thread
+ * applying operations walks the list of clients.
+ */
+struct Client {
+  int fd;
+  struct Session *session;
+  struct Client *next;
+};
+
+/*
+ * Initialize an empty queue.
+ *
+ * @param q A pointer to a queue.
+ */
+void queue_init(struct Queue *q) {
+  atomic_init(&q->stub.next, NULL);
+  atomic_init(&q->head, &q->stub);
+  q->tail = &q->stub;
+  sem_init(&q->ready, 0, 0);
+}
+
+/*
+ * Link a message in at the head of the queue.
+ *
+ * @param q A pointer to a queue.
+ * @param m A pointer to a message.
+ */
+void queue_link(struct Queue *q, struct Message *m) {
+  atomic_store(&m->next, NULL);
+  atomic_store(&atomic_exchange(&q->head, m)->next, m);
+}
+
+/*
+ * Push a message onto the queue, waking up the consumer.
+ *
+ * @param q A pointer to a queue.
+ * @param m A pointer to a message.
+ */
+void queue_push(struct Queue *q, struct Message *m) {
+  queue_link(q, m);
+  count(&counters()->enqueued[QUEUE_SESSION], 1);
+  sem_post(&q->ready);
+}
+
+/*
+ * Pop the oldest message off of the queue, waiting for one
+ * when it is empty.
+ *
+ * A producer that swapped itself in but hasn't linked itself
+ * to its predecessor yet is waited out.
+ *
+ * @param q A pointer to a queue.
+ * @return A pointer to the message.
+ */
+struct Message *queue_pop(struct Queue *q) {
+  sem_wait(&q->ready);
+
+  count(&counters()->dequeued[QUEUE_SESSION], 1);
+
+  for (;;) {
+    struct Message *tail = q->tail, *next = atomic_load(&tail->next);
+
+    if (tail == &q->stub) {
+      if (!next) {
+        sched_yield();
+        continue;
+      }
+
+      q->tail = tail = next;
+      next = atomic_load(&tail->next);
+    }
+
+    if (next) {
+      q->tail = next;
+      return tail;
+    }
+
+    if (tail == atomic_load(&q->head))
+      queue_link(q, &q->stub);
+
+    sched_yield();
+  }
+}
+
+/*
+ * The body of a client thread, which parses every line the
+ * client sends and queues it for the session.
+ *
+ * The message announcing that the client left is set aside up
+ * front, a client is disconnected when memory runs out for the
+ * lines it sends.
+ *
+ * @param arg A pointer to the client.
+ */
+void *client_thread(void *arg) {
+  struct Client *client = (struct Client*)arg;
+  struct Queue *queue = &client->session->queue;
+
+  struct Message *join = (struct Message*)slab_alloc(sizeof(struct Message)),
+                 *leave = (struct Message*)slab_alloc(sizeof(struct Message));
+
+  if (!join || !leave) {
+    slab_free(join, sizeof(struct Message));
+    slab_free(leave, sizeof(struct Message));
+    close(client->fd);
+    slab_free(client, sizeof(struct Client));
+    slab_release();
+    return NULL;
+  }
+
+  join->kind = MESSAGE_JOIN;
+  join->client = client;
+
+  queue_push(queue, join);
+
+  FILE *in = fdopen(dup(client->fd), "r");
+
+  struct Parser parser;
+
+  while (in && fgets(parser.line, LINE_MAX, in)) {
+    parser.line[strcspn(parser.line, "\r\n")] = 0;
+
+    if (!parser.line[strspn(parser.line, " ")]) continue;
+
+    struct Message *m = (struct Message*)slab_alloc(sizeof(struct Message));
+
+    if (!m) break;
+
+    m->kind = MESSAGE_OP;
+    m->client = client;
+    m->op = parse(parser);
+
+    queue_push(queue, m);
+  }
+
+  if (in) fclose(in);
+
+  leave->kind = MESSAGE_LEAVE;
+  leave->client = client;
+
+  queue_push(queue, leave);
+
+  slab_release();
+
+  return NULL;
+}
+
+/*
+ * The body of the thread accepting clients into a session.
+ *
+ * @param arg A pointer to a session.
+ */
+void *session_accept(void *arg) {
+  struct Session *session = (struct Session*)arg;
+
+  for (;;) {
+    int fd = accept(session->listener, NULL, NULL);
+
+    if (fd < 0) continue;
+
+    struct Client *client = (struct Client*)slab_alloc(sizeof(struct Client));
+
+    if (!client) {
+      close(fd);
+      continue;
+    }
+
+    client->fd = fd;
+    client->session = session;
+
+    pthread_t thread;
+
+    pthread_create(&thread, NULL, client_thread, client);
+    pthread_detach(thread);
+  }
+
+  return NULL;
+}
+
+/*
+ * Evaluate an operation sent by a client, sending whatever it
+ * prints back to that client alone.
+ *
+ * @param i A pointer to an interpreter.
+ * @param client A pointer to the client.
+ */
+void session_eval(struct Interpreter *i, struct Client *client) {
+  if (i->op.cmd == END) {
+    shutdown(client->fd, SHUT_RDWR);
+    return;
+  }
+
+  char *buffer = NULL;
+  size_t size = 0;
+
+  output = open_memstream(&buffer, &size);
+
+  if (i->op.cmd == VIEWER)
+    fprintf(out(), "error: The viewer needs a terminal\n");
+  else
+    eval(i);
+
+  fclose(output);
+  output = NULL;
+
+  write_all(client->fd, buffer, size);
+  free(buffer);
+}
+
+/*
+ * Find the part of the canvas the loaded operation changed.
+ *
+ * @param i A pointer to an interpreter.
+ * @param drawn The size of the display list before evaluating.
+ * @param r Set to the changed region.
+ * @return Whether or not anything changed.
+ */
+int session_dirty(struct Interpreter *i, size_t drawn, struct Rect *r) {
+  struct Grid *g = &i->grid;
+
+  struct Rect canvas = { 0, 0, g->width - 1, g->height - 1 };
+
+  if (!g->initialized) return 0;
+
+  switch (i->op.cmd) {
+    case CLEAR:
+    case GRID:
+    case INCLUDE:
+      *r = canvas;
+      return 1;
+    case CIRCLE:
+    case LINE:
+    case POINT:
+    case RECTANGLE:
+      if (i->list.size <= drawn) return 0;
+      *r = i->list.items[i->list.size - 1].box;
+      break;
+    default:
+      return 0;
+  }
+
+  if (!intersects(*r, canvas)) return 0;
+
+  if (r->x1 < 0) r->x1 = 0;
+  if (r->y1 < 0) r->y1 = 0;
+  if (r->x2 > canvas.x2) r->x2 = canvas.x2;
+  if (r->y2 > canvas.y2) r->y2 = canvas.y2;
+
+  return 1;
+}
+
+/*
+ * Run a shared session on a Unix socket, drawing what every
+ * connected client sends onto a single canvas.
+ *
+ * Operations are applied one at a time in the order they were
+ * queued and numbered in that order. Every region they change
+ * is announced to all clients as `DIRTY seq x1,y1 x2,y2`, which
+ * clients that aren't keeping up miss rather than stalling the
+ * session.
+ *
+ * @param i A pointer to an interpreter.
+ * @param path The socket path.
+ * @return Whether or not the socket could be set up.
+ */
+int serve(struct Interpreter *i, const char *path) {
+  struct Session session;
+
+  struct Client *clients = NULL;
+
+  unsigned long seq = 0;
+
+  if ((session.listener = listen_on(path)) < 0) return 0;
+
+  queue_init(&session.queue);
+
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_t thread;
+
+  pthread_create(&thread, NULL, session_accept, &session);
+  pthread_detach(thread);
+
+  for (;;) {
+    struct Message *m = queue_pop(&session.queue);
+
+    struct Client *client = m->client;
+
+    if (m->kind == MESSAGE_JOIN) {
+      client->next = clients;
+      clients = client;
+    } else if (m->kind == MESSAGE_LEAVE) {
+      for (struct Client **link = &clients; *link; link = &(*link)->next)
+        if (*link == client) {
+          *link = client->next;
+          break;
+        }
+
+      close(client->fd);
+      slab_free(client, sizeof(struct Client));
+    } else {
+      size_t drawn = i->list.size;
+
+      struct Rect r;
+
+      load(i, m->op);
+      session_eval(i, client);
+
+      ++seq;
+
+      if (session_dirty(i, drawn, &r)) {
+        char line[96];
+
+        int n = snprintf(
+          line, sizeof(line), "DIRTY %lu %d,%d %d,%d\n", seq, r.x1, r.y1, r.x2, r.y2
+        );
+
+        for (struct Client *c = clients; c; c = c->next)
+          send(c->fd, line, n, MSG_DONTWAIT);
+      }
+
+      operation_free(&m->op);
+    }
+
+    slab_free(m, sizeof(struct Message));
+  }
+}
+
+/*
+ * The number of threads multiplexing `--sessions` connections.
+ */
+#define SESSION_THREADS 4
+
+/*
+ * Stackless coroutines in the style of protothreads.
+ *
+ * A coroutine is a function that switches on the line it last
+ * yielded at to pick up where it left off. Nothing on its stack
+ * survives a yield, so whatever it needs afterwards has to live
+ * in its struct.
+ */
+#define CO_BEGIN(resume) switch (resume) { case 0:
+#define CO_YIELD(resume, value) do { resume = __LINE__; return value; case __LINE__:; } while (0)
+#define CO_END(resume) }
+
+/*
+ * What a suspended session is waiting for.
+ */
+enum Wait { WAIT_INPUT, WAIT_OUTPUT, WAIT_DONE };
+
+/*
+ * An interactive session with its own canvas, run as a coroutine
+ * by whichever session thread its connection is ready on.
+ *
+ * `input` holds what has been read but not evaluated yet, and
+ * `pending` what has been printed but not written yet.
+ */
+struct Connection {
+  int fd;
+  int resume;
+  struct Interpreter interpreter;
+  char input[LINE_MAX];
+  size_t buffered;
+  char *pending;
+  size_t size;
+  size_t written;
+};
+
+/*
+ * Take the next line out of a session's input.
+ *
+ * @param c A pointer to a connection.
+ * @param parser Set to the line.
+ * @return Whether or not a whole line had been read, lines too
+ *         long to fit are cut short.
+ */
+int connection_line(struct Connection *c, struct Parser *parser) {
+  char *newline = (char*)memchr(c->input, '\n', c->buffered);
+
+  size_t n = newline ? (size_t)(newline - c->input) + 1 : c->buffered;
+
+  if (!newline && c->buffered < sizeof(c->input) - 1) return 0;
+
+  memcpy(parser->line, c->input, n);
+  parser->line[n] = 0;
+  parser->line[strcspn(parser->line, "\r\n")] = 0;
+
+  memmove(c->input, c->input + n, c->buffered - n);
+  c->buffered -= n;
+
+  return 1;
+}
+
+/*
+ * The read-parse-eval loop of a session as a coroutine, which
+ * yields whenever its connection has no input for it or takes
+ * no more output.
+ *
+ * @param c A pointer to a connection.
+ * @return What the session is waiting for.
+ */
+enum Wait connection_run(struct Connection *c) {
+  struct Interpreter *i = &c->interpreter;
+
+  struct Parser parser;
+
+  ssize_t n;
+
+  CO_BEGIN(c->resume);
+
+  for (;;) {
+    while (c->written < c->size) {
+      n = write(c->fd, c->pending + c->written, c->size - c->written);
+
+      if (n > 0) {
+        c->written += n;
+        count(&counters()->bytes, n);
+      } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        CO_YIELD(c->resume, WAIT_OUTPUT);
+      } else {
+        return WAIT_DONE;
+      }
+    }
+
+    free(c->pending);
+    c->pending = NULL;
+    c->size = c->written = 0;
+
+    while (!connection_line(c, &parser)) {
+      n = read(c->fd, c->input + c->buffered, sizeof(c->input) - 1 - c->buffered);
+
+      if (n > 0)
+        c->buffered += n;
+      else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        CO_YIELD(c->resume, WAIT_INPUT);
+      else
+        return WAIT_DONE;
+    }
+
+    output = open_memstream(&c->pending, &c->size);
+
+    if (parser.line[strspn(parser.line, " ")]) {
+      load(i, parse(parser));
+
+      if (i->op.cmd == END) {
+        operation_free(&i->op);
+        fclose(output);
+        output = NULL;
+        return WAIT_DONE;
+      }
+
+      if (i->op.cmd == VIEWER)
+        fprintf(out(), "error: The viewer needs a terminal\n");
+      else
+        eval(i);
+
+      operation_free(&i->op);
+    }
+
+    fprintf(out(), "> ");
+
+    fclose(output);
+    output = NULL;
+  }
+
+  CO_END(c->resume);
+
+  return WAIT_DONE;
+}
+
+/*
+ * The state shared by the session threads.
+ */
+struct Sessions {
+  int epoll;
+  int listener;
+  struct Interpreter template;
+};
+
+/*
+ * Accept every pending connection as a new session.
+ *
+ * @param s A pointer to the sessions.
+ */
+void sessions_accept(struct Sessions *s) {
+  int fd;
+
+  while ((fd = accept4(s->listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+    struct Connection *c = (struct Connection*)slab_calloc(sizeof(struct Connection));
+
+    if (!c) {
+      close(fd);
+      continue;
+    }
+
+    c->fd = fd;
+    c->interpreter = s->template;
+    c->pending = strdup("> ");
+    c->size = 2;
+
+    struct epoll_event e = { EPOLLOUT | EPOLLONESHOT, { .ptr = c } };
+
+    epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &e);
+  }
+}
+
+/*
+ * The body of a session thread, which resumes whichever session
+ * is ready next.
+ *
+ * Connections are registered one-shot, so a session only ever
+ * runs on one thread at a time and is handed back to epoll with
+ * whatever it is waiting for once it yields.
+ *
+ * @param arg A pointer to the sessions.
+ */
+void *sessions_thread(void *arg) {
+  struct Sessions *s = (struct Sessions*)arg;
+
+  for (;;) {
+    struct epoll_event e;
+
+    if (epoll_wait(s->epoll, &e, 1, -1) <= 0) continue;
+
+    if (!e.data.ptr) {
+      sessions_accept(s);
+
+      e = (struct epoll_event) { EPOLLIN | EPOLLONESHOT, { .ptr = NULL } };
+      epoll_ctl(s->epoll, EPOLL_CTL_MOD, s->listener, &e);
+      continue;
+    }
+
+    struct Connection *c = (struct Connection*)e.data.ptr;
+
+    enum Wait wait = connection_run(c);
+
+    if (wait == WAIT_DONE) {
+      close(c->fd);
+      interpreter_free(&c->interpreter);
+      free(c->pending);
+      slab_free(c, sizeof(struct Connection));
+      continue;
+    }
+
+    e.events = (wait == WAIT_INPUT ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+    epoll_ctl(s->epoll, EPOLL_CTL_MOD, c->fd, &e);
+  }
+
+  return NULL;
+}
+
+/*
+ * Serve interactive sessions on a Unix socket, each
+ * connection getting its own canvas.
+ *
+ * Sessions are coroutines multiplexed by `SESSION_THREADS`
+ * threads, an idle one costs little more than its input buffer.
+ * Their canvases are drawn inline rather than on a shared pool.
+ *
+ * @param path The socket path.
+ * @param template The interpreter every session starts out as.
+ * @return Whether or not the socket could be set up.
+ */
+int sessions(const char *path, struct Interpreter template) {
+  struct Sessions *s = (struct Sessions*)malloc(sizeof(struct Sessions));
+
+  if ((s->listener = listen_on(path)) < 0) return 0;
+
+  fcntl(s->listener, F_SETFL, fcntl(s->listener, F_GETFL) | O_NONBLOCK);
+
+  s->epoll = epoll_create1(0);
+  s->template = template;
+  s->template.grid.pool = NULL;
+
+  struct epoll_event e = { EPOLLIN | EPOLLONESHOT, { .ptr = NULL } };
+
+  epoll_ctl(s->epoll, EPOLL_CTL_ADD, s->listener, &e);
+
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_t threads[SESSION_THREADS];
+
+  for (int k = 0; k < SESSION_THREADS; ++k)
+    pthread_create(&threads[k], NULL, sessions_thread, s);
+
+  for (int k = 0; k < SESSION_THREADS; ++k)
+    pthread_join(threads[k], NULL);
+
+  return 1;
+}
+
+/*
+ * An operation sent from the shard coordinator to its workers.
+ */
+struct ShardMessage {
+  enum Command cmd;
+  int args[ARGS_MAX];
+};
+
+/*
+ * The coordinator's view of a canvas split across workers.
+ *
+ * Worker `k` owns `band` rows starting at row `k * band`, the
+ * last ones own fewer or none.
+ */
+struct Shards {
+  int count;
+  int *fds;
+  int initialized;
+  int width;
+  int height;
+  int band;
+};
+
+/*
+ * Read a whole buffer from a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param buffer The buffer to fill.
+ * @param n The number of bytes.
+ * @return Whether or not everything was read.
+ */
+int read_all(int fd, void *buffer, size_t n) {
+  char *b = (char*)buffer;
+
+  while (n) {
+    ssize_t got = read(fd, b, n);
+
+    if (got <= 0) return 0;
+
+    b += got;
+    n -= got;
+  }
+
+  return 1;
+}
+
+/*
+ * The number of rows owned by each worker, rounded up to whole
+ * strips so no strip is split between workers.
+ *
+ * @param height The canvas height.
+ * @param count The number of workers.
+ * @return The number of rows.
+ */
+int shard_band(int height, int count) {
+  int strips = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+  return (strips + count - 1) / count * TILE_SIZE;
+}
+
+/*
+ * Send a worker the cells of its band that fall in a region,
+ * top row first, preceded by their length.
+ *
+ * @param fd The connection to the coordinator.
+ * @param i A pointer to the worker's interpreter.
+ * @param y0 The canvas row the worker's band starts at.
+ * @param r The region, in canvas coordinates.
+ */
+void shard_rows(int fd, struct Interpreter *i, int y0, struct Rect r) {
+  struct Grid *g = &i->grid;
+
+  size_t width = r.x2 - r.x1 + 1, n = 0;
+
+  int y1 = r.y1 - y0 > 0 ? r.y1 - y0 : 0,
+      y2 = g->initialized && r.y2 - y0 < g->height ? r.y2 - y0 : g->height - 1;
+
+  if (!g->initialized || y1 > y2) {
+    write_all(fd, (char*)&n, sizeof(n));
+    return;
+  }
+
+  flush(g, &i->list);
+  thaw(g, y1, y2);
+
+  n = width * (y2 - y1 + 1);
+
+  char *cells = (char*)malloc(n), *o = cells;
+
+  for (int y = y2; y >= y1; --y, o += width)
+    unblank(o, row(g, y) + r.x1, width);
+
+  write_all(fd, (char*)&n, sizeof(n));
+  write_all(fd, cells, n);
+
+  free(cells);
+}
+
+/*
+ * The body of a shard worker, which evaluates every operation
+ * the coordinator sends against its own band of the canvas.
+ *
+ * Operations are moved into the band's coordinates, anything
+ * they draw outside of it is clipped away as it would be at the
+ * edge of a canvas.
+ *
+ * @param fd The connection to the coordinator.
+ * @param k The worker number.
+ * @param count The number of workers.
+ * @param i A pointer to the worker's interpreter.
+ */
+void shard_worker(int fd, int k, int count, struct Interpreter *i) {
+  struct ShardMessage m;
+
+  int y0 = 0;
+
+  freopen("/dev/null", "w", stdout);
+
+  while (read_all(fd, &m, sizeof(m))) {
+    struct Operation op = { .name = "", .cmd = m.cmd };
+
+    memcpy(op.args, m.args, sizeof(op.args));
+
+    switch (m.cmd) {
+      case CIRCLE:
+      case POINT:
+        op.args[1] = clamp((long long)op.args[1] - y0);
+        break;
+      case DISPLAY:
+        shard_rows(fd, i, y0, (struct Rect) { m.args[0], m.args[1], m.args[2], m.args[3] });
+        continue;
+      case GRID: {
+        int band = shard_band(m.args[1], count);
+
+        y0 = k * band;
+        op.args[1] = band < m.args[1] - y0 ? band : m.args[1] - y0;
+
+        if (op.args[1] <= 0) continue;
+        break;
+      }
+      case LINE:
+      case RECTANGLE:
+        op.args[1] = clamp((long long)op.args[1] - y0);
+        op.args[3] = clamp((long long)op.args[3] - y0);
+        break;
+      default:
+        break;
+    }
+
+    load(i, op);
+    eval(i);
+  }
+
+  exit(0);
+}
+
+/*
+ * Send an operation to every worker.
+ *
+ * @param s A pointer to the shards.
+ * @param cmd The command.
+ * @param args The arguments.
+ */
+void shard_broadcast(struct Shards *s, enum Command cmd, int args[]) {
+  struct ShardMessage m = { .cmd = cmd };
+
+  memcpy(m.args, args, sizeof(m.args));
+
+  for (int k = 0; k < s->count; ++k)
+    write_all(s->fds[k], (char*)&m, sizeof(m));
+}
+
+/*
+ * Print a region of the sharded canvas the way `DISPLAY` does,
+ * stitching together the rows every worker sends back.
+ *
+ * @param s A pointer to the shards.
+ * @param r The region.
+ */
+void shard_region(struct Shards *s, struct Rect r) {
+  int wrap = 10;
+
+  size_t width = r.x2 - r.x1 + 1;
+
+  shard_broadcast(s, DISPLAY, (int[]) { r.x1, r.y1, r.x2, r.y2 });
+
+  for (int k = s->count - 1; k >= 0; --k) {
+    size_t n;
+
+    if (!read_all(s->fds[k], &n, sizeof(n))) {
+      fprintf(out(), "error: Shard %d is gone\n", k);
+      exit(1);
+    }
+
+    char *cells = (char*)malloc(n);
+
+    read_all(s->fds[k], cells, n);
+
+    int top = (k + 1) * s->band - 1 < r.y2 ? (k + 1) * s->band - 1 : r.y2;
+
+    for (size_t j = 0; j < n / width; ++j) {
+      fprintf(out(), "%d ", (((top - (int)j) - wrap) % wrap + wrap) % wrap);
+      fwrite(cells + j * width, 1, width, out());
+      fprintf(out(), "\n");
+    }
+
+    free(cells);
+  }
+
+  fprintf(out(), " ");
+
+  for (int i = r.x1; i <= r.x2; ++i)
+    fprintf(out(), "%d", ((i - wrap) % wrap + wrap) % wrap);
+
+  fprintf(out(), "\n");
+}
+
+/*
+ * Evaluate an operation on the sharded canvas.
+ *
+ * The coordinator reports errors itself, workers only ever see
+ * operations that are valid for the whole canvas.
+ *
+ * @param s A pointer to the shards.
+ * @param op An operation struct.
+ */
+void shard_eval(struct Shards *s, struct Operation op) {
+  switch (op.cmd) {
+    case CHAR:
+    case CLEAR:
+      shard_broadcast(s, op.cmd, op.args);
+      break;
+    case CIRCLE:
+    case LINE:
+    case POINT:
+    case RECTANGLE:
+      if (!s->initialized) {
+        fprintf(out(), "error: Grid isn't initialized\n");
+        break;
+      }
+      shard_broadcast(s, op.cmd, op.args);
+      break;
+    case DISPLAY:
+      if (!s->initialized) {
+        fprintf(out(), "error: Grid isn't initialized\n");
+        break;
+      }
+      shard_region(s, (struct Rect) { 0, 0, s->width - 1, s->height - 1 });
+      break;
+    case END:
+      shard_broadcast(s, END, op.args);
+      for (int k = 0; k < s->count; ++k) wait(NULL);
+      exit(0);
+    case GRID:
+      if (s->initialized) {
+        fprintf(out(), "error: Grid has already been initialized\n");
+        break;
+      }
+      if (op.args[0] <= 0 || op.args[1] <= 0) {
+        fprintf(out(), "error: Grid dimensions must be positive\n");
+        break;
+      }
+      s->initialized = 1;
+      s->width = op.args[0];
+      s->height = op.args[1];
+      s->band = shard_band(s->height, s->count);
+      shard_broadcast(s, GRID, op.args);
+      break;
+    case INCLUDE: {
+      struct Module *m = include_enter(op.path);
+
+      if (!m) break;
+
+      for (size_t k = 0; k < m->script.size && m->script.ops[k].cmd != END; ++k)
+        shard_eval(s, m->script.ops[k]);
+
+      include_leave(m);
+      break;
+    }
+    case INVALID:
+      fprintf(out(), "error: Invalid command `%s`\n", op.name);
+      break;
+    case VIEW: {
+      int x = op.args[0], y = op.args[1], width = op.args[2], height = op.args[3];
+
+      if (!s->initialized) {
+        fprintf(out(), "error: Grid isn't initialized\n");
+        break;
+      }
+
+      if (x < 0 || x >= s->width || y < 0 || y >= s->height || width <= 0 || height <= 0) {
+        fprintf(out(), "error: Viewport is out of bounds\n");
+        break;
+      }
+
+      shard_region(s, (struct Rect) {
+        x,
+        y,
+        width < s->width - x ? x + width - 1 : s->width - 1,
+        height < s->height - y ? y + height - 1 : s->height - 1
+      });
+      break;
+    }
+    case MEMORY:
+    case STATS:
+    case VIEWER:
+    case ZOOM:
+      fprintf(out(), "error: `%s` isn't supported on a sharded canvas\n", op.name);
+      break;
+  }
+}
+
+/*
+ * Split the canvas into row bands owned by worker processes and
+ * coordinate them from standard input.
+ *
+ * Workers are connected over Unix sockets and each rasterize only
+ * their own band, with their own thread pool.
+ *
+ * Metrics are only served once every worker has been forked, so
+ * that none of them inherits a lock held by the metrics thread.
+ *
+ * @param count The number of workers.
+ * @param threads The number of threads per worker.
+ * @param i The interpreter every worker starts out as.
+ * @param metrics_path Where to serve metrics, or `NULL`.
+ */
+void shard(int count, int threads, struct Interpreter i, const char *metrics_path) {
+  struct Shards s = {
+    .count = count,
+    .fds = (int*)malloc(count * sizeof(int))
+  };
+
+  struct Parser parser;
+
+  fflush(stdout);
+
+  for (int k = 0; k < count; ++k) {
+    int pair[2];
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+
+    if (!fork()) {
+      struct Pool pool;
+
+      for (int j = 0; j < k; ++j) close(s.fds[j]);
+      close(pair[0]);
+
+      pool_init(&pool, threads);
+      i.grid.pool = &pool;
+
+      shard_worker(pair[1], k, count, &i);
+    }
+
+    close(pair[1]);
+    s.fds[k] = pair[0];
+  }
+
+  if (metrics_path && !metrics(metrics_path)) {
+    fprintf(stderr, "error: Can't listen on `%s`\n", metrics_path);
+    exit(1);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  for (;;) {
+    fprintf(out(), "> ");
+    read_line(&parser);
+    struct Operation op = parse(parser);
+
+    shard_eval(&s, op);
+    operation_free(&op);
+  }
+}
+
+/*
+ * The number of times a script is retried after crashing its
+ * worker before it is given up on.
+ */
+#define BATCH_RETRIES 2
+
+/*
+ * A script of a batch and how it went.
+ */
+struct Job {
+  const char *path;
+  int attempts;
+  int done;
+};
+
+/*
+ * The result a batch worker sends back for a script, followed
+ * by `size` bytes of output.
+ */
+struct JobResult {
+  int index;
+  double seconds;
+  size_t size;
+};
+
+/*
+ * A batch worker process as seen by the coordinator.
+ *
+ * Its share of the scripts sits in `queue[head..tail)`, it works
+ * from the front and idle workers steal from the back. `job` is
+ * the script it is running, or -1.
+ */
+struct BatchWorker {
+  pid_t pid;
+  int fd;
+  int *queue;
+  int head;
+  int tail;
+  int job;
+  int jobs;
+  double busy;
+};
+
+/*
+ * Run a script through a fresh interpreter, capturing what it
+ * prints.
+ *
+ * @param i A pointer to an interpreter.
+ * @param path The script path.
+ * @param buffer Set to the output, owned by the caller.
+ * @param size Set to the length of the output.
+ */
+void batch_run(struct Interpreter *i, const char *path, char **buffer, size_t *size) {
+  struct Script script;
+
+  output = open_memstream(buffer, size);
+
+  if (compile(i->grid.pool, path, &script)) run(i, &script);
+  else fprintf(out(), "error: Can't open `%s`\n", path);
+
+  script_free(&script);
+
+  fclose(output);
+  output = NULL;
+
+  interpreter_free(i);
+}
+
+/*
+ * The body of a batch worker, which runs every script the
+ * coordinator sends it.
+ *
+ * @param fd The connection to the coordinator.
+ * @param jobs The scripts of the batch.
+ * @param i A pointer to the worker's interpreter.
+ */
+void batch_worker(int fd, struct Job *jobs, struct Interpreter *i) {
+  int index;
+
+  while (read_all(fd, &index, sizeof(index))) {
+    char *output = NULL;
+
+    double start = now();
+
+    struct JobResult result = { .index = index };
+
+    batch_run(i, jobs[index].path, &output, &result.size);
+
+    result.seconds = now() - start;
+
+    write_all(fd, (char*)&result, sizeof(result));
+    write_all(fd, output, result.size);
+
+    free(output);
+  }
+
+  exit(0);
+}
+
+/*
+ * Start a batch worker process.
+ *
+ * @param w A pointer to the worker.
+ * @param workers All of the workers, whose connections the new
+ *                process has no use for.
+ * @param count The number of workers.
+ * @param jobs The scripts of the batch.
+ * @param threads The number of threads the worker draws with.
+ * @param i The interpreter the worker starts out as.
+ */
+void batch_spawn(
+  struct BatchWorker *w,
+  struct BatchWorker *workers,
+  int count,
+  struct Job *jobs,
+  int threads,
+  struct Interpreter i
+) {
+  int pair[2];
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+
+  fflush(NULL);
+
+  if (!(w->pid = fork())) {
+    struct Pool pool;
+
+    for (int k = 0; k < count; ++k)
+      if (workers[k].fd >= 0) close(workers[k].fd);
+
+    close(pair[0]);
+
+    pool_init(&pool, threads);
+    i.grid.pool = &pool;
+
+    batch_worker(pair[1], jobs, &i);
+  }
+
+  close(pair[1]);
+
+  w->fd = pair[0];
+  w->job = -1;
+}
+
+/*
+ * Hand an idle worker its next script, from the front of its own
+ * queue or else stolen from the back of the longest other one.
+ *
+ * @param w A pointer to the worker.
+ * @param workers All of the workers.
+ * @param count The number of workers.
+ * @return Whether or not there was a script left.
+ */
+int batch_next(struct BatchWorker *w, struct BatchWorker *workers, int count) {
+  if (w->head < w->tail) {
+    w->job = w->queue[w->head++];
+  } else {
+    struct BatchWorker *victim = NULL;
+
+    for (int k = 0; k < count; ++k)
+      if (!victim || workers[k].tail - workers[k].head > victim->tail - victim->head)
+        victim = &workers[k];
+
+    if (victim->head >= victim->tail) return 0;
+
+    w->job = victim->queue[--victim->tail];
+  }
+
+  write_all(w->fd, (char*)&w->job, sizeof(w->job));
+
+  return 1;
+}
+
+/*
+ * Append a file to a ustar archive.
+ *
+ * @param archive The archive.
+ * @param name The name of the file.
+ * @param data The contents of the file.
+ * @param size The length of the contents.
+ */
+void tar_append(FILE *archive, const char *name, const char *data, size_t size) {
+  char header[512] = { 0 }, padding[512] = { 0 };
+
+  const char *split = NULL;
+
+  if (strlen(name) > 100)
+    for (const char *s = strchr(name, '/'); s; s = strchr(s + 1, '/'))
+      if (s - name <= 155 && strlen(s + 1) <= 100) {
+        split = s;
+        break;
+      }
+
+  if (split) {
+    memcpy(header + 345, name, split - name);
+    name = split + 1;
+  }
+
+  strncpy(header, name, 100);
+  snprintf(header + 100, 8, "%07o", 0644);
+  snprintf(header + 108, 8, "%07o", 0);
+  snprintf(header + 116, 8, "%07o", 0);
+  snprintf(header + 124, 12, "%011zo", size);
+  snprintf(header + 136, 12, "%011lo", (unsigned long)time(NULL));
+  memset(header + 148, ' ', 8);
+  header[156] = '0';
+  memcpy(header + 257, "ustar", 6);
+  memcpy(header + 263, "00", 2);
+
+  unsigned sum = 0;
+
+  for (int k = 0; k < 512; ++k)
+    sum += (unsigned char)header[k];
+
+  snprintf(header + 148, 8, "%06o", sum);
+
+  fwrite(header, 1, 512, archive);
+  fwrite(data, 1, size, archive);
+  fwrite(padding, 1, (512 - size % 512) % 512, archive);
+}
+
+/*
+ * Render a batch of scripts with a pool of worker processes,
+ * collecting the output of every script into a ustar archive as
+ * `<script>.out`.
+ *
+ * Scripts are dealt out to the workers in contiguous runs, a
+ * worker that runs out steals from whoever has the most left. A
+ * script that crashes its worker is retried on a fresh one up to
+ * `BATCH_RETRIES` times before it is recorded as failed.
+ *
+ * @param path The archive path.
+ * @param paths The script paths.
+ * @param n The number of scripts.
+ * @param count The number of worker processes.
+ * @param threads The number of threads each worker draws with.
+ * @param i The interpreter every worker starts out as.
+ * @return The exit status.
+ */
+int batch(const char *path, char **paths, int n, int count, int threads, struct Interpreter i) {
+  FILE *archive = fopen(path, "wb");
+
+  if (!archive) {
+    fprintf(stderr, "error: Can't create `%s`\n", path);
+    return 1;
+  }
+
+  if (count > n) count = n > 0 ? n : 1;
+
+  struct Job *jobs = (struct Job*)calloc(n, sizeof(struct Job));
+
+  struct BatchWorker *workers = (struct BatchWorker*)calloc(count, sizeof(struct BatchWorker));
+
+  struct pollfd *fds = (struct pollfd*)malloc(count * sizeof(struct pollfd));
+
+  int *order = (int*)malloc(n * sizeof(int)), remaining = n, failed = 0;
+
+  double start = now();
+
+  for (int j = 0; j < n; ++j) {
+    jobs[j].path = paths[j];
+    order[j] = j;
+  }
+
+  for (int k = 0; k < count; ++k) {
+    workers[k].fd = -1;
+    workers[k].queue = order;
+    workers[k].head = (long long)n * k / count;
+    workers[k].tail = (long long)n * (k + 1) / count;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  for (int k = 0; k < count; ++k) {
+    batch_spawn(&workers[k], workers, count, jobs, threads, i);
+    batch_next(&workers[k], workers, count);
+  }
+
+  while (remaining) {
+    for (int k = 0; k < count; ++k)
+      fds[k] = (struct pollfd) { workers[k].job >= 0 ? workers[k].fd : -1, POLLIN, 0 };
+
+    if (poll(fds, count, -1) < 0) continue;
+
+    for (int k = 0; k < count; ++k) {
+      struct BatchWorker *w = &workers[k];
+
+      struct JobResult result;
+
+      if (!fds[k].revents) continue;
+
+      if (read_all(w->fd, &result, sizeof(result))) {
+        char *output = (char*)malloc(result.size + 1);
+
+        read_all(w->fd, output, result.size);
+
+        char *name = (char*)malloc(strlen(jobs[result.index].path) + 5);
+
+        sprintf(name, "%s.out", jobs[result.index].path + strspn(jobs[result.index].path, "/"));
+        tar_append(archive, name, output, result.size);
+
+        free(name);
+        free(output);
+
+        jobs[result.index].done = 1;
+        w->busy += result.seconds;
+        ++w->jobs;
+        --remaining;
+
+        if (!batch_next(w, workers, count)) w->job = -1;
+
+        continue;
+      }
+
+      struct Job *job = &jobs[w->job];
+
+      close(w->fd);
+      waitpid(w->pid, NULL, 0);
+      w->fd = -1;
+
+      if (++job->attempts > BATCH_RETRIES) {
+        char message[64];
+
+        int size = snprintf(message, sizeof(message), "error: Crashed %d times\n", job->attempts);
+
+        char *name = (char*)malloc(strlen(job->path) + 8);
+
+        sprintf(name, "%s.failed", job->path + strspn(job->path, "/"));
+        tar_append(archive, name, message, size);
+
+        free(name);
+
+        ++failed;
+        --remaining;
+      } else {
+        w->queue[--w->head] = w->job;
+      }
+
+      batch_spawn(w, workers, count, jobs, threads, i);
+
+      if (!batch_next(w, workers, count)) w->job = -1;
+    }
+  }
+
+  double elapsed = now() - start;
+
+  for (int k = 0; k < count; ++k) {
+    close(workers[k].fd);
+    waitpid(workers[k].pid, NULL, 0);
+  }
+
+  char end[1024] = { 0 };
+
+  fwrite(end, 1, sizeof(end), archive);
+  fclose(archive);
+
+  fprintf(
+    out(),
+    "scripts: %d (%d failed) in %.3fs, %.1f scripts/s\n",
+    n,
+    failed,
+    elapsed,
+    elapsed > 0 ? n / elapsed : 0.0
+  );
+
+  for (int k = 0; k < count; ++k)
+    fprintf(
+      out(),
+      "worker %d: %d scripts, %.1f%% busy\n",
+      k,
+      workers[k].jobs,
+      elapsed > 0 ? 100 * workers[k].busy / elapsed : 0.0
+    );
+
+  return failed ? 1 : 0;
+}
+
+/*
+ * How many of the costliest scripts the fuzzer keeps, both by
+ * time and by memory, to mutate further and to report.
+ */
+#define FUZZ_KEEP 8
+
+/*
+ * The most lines a fuzzed script grows to.
+ */
+#define FUZZ_LINES 64
+
+/*
+ * How long a fuzzed script may run, in seconds, before it is
+ * stopped and scored as it stands.
+ */
+#define FUZZ_TIMEOUT 1
+
+/*
+ * The most memory a fuzzed script may map, in bytes.
+ */
+#define FUZZ_MEMORY (4UL << 30)
+
+/*
+ * What running a fuzzed script cost, in total and per command.
+ */
+struct FuzzCost {
+  double seconds;
+  long memory;
+  double command[COMMANDS];
+  unsigned long ops[COMMANDS];
+  int timed_out;
+  int crashed;
+};
+
+/*
+ * A fuzzed script and what it cost to run.
+ */
+struct FuzzInput {
+  char *text;
+  size_t size;
+  struct FuzzCost cost;
+};
+
+/*
+ * The state of a fuzzed script running in a child process, for
+ * reporting it when it runs out of time.
+ */
+struct {
+  int fd;
+  struct FuzzCost cost;
+  enum Command cmd;
+  double began;
+} fuzz_child;
+
+/*
+ * The next number of a xorshift generator.
+ *
+ * @param state A pointer to the generator state.
+ * @return The number.
+ */
+uint64_t fuzz_random(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/*
+ * A coordinate or size for a fuzzed command, mostly small with
+ * a fair share of the extremes that trip up the rasterizer.
+ *
+ * @param state A pointer to the generator state.
+ * @return The number.
+ */
+unsigned long fuzz_number(uint64_t *state) {
+  switch (fuzz_random(state) % 8) {
+    case 0:
+    case 1:
+    case 2:
+      return fuzz_random(state) % 100;
+    case 3:
+      return fuzz_random(state) % 10000;
+    case 4:
+      return fuzz_random(state) % 10000000;
+    case 5:
+      return ARC_RADIUS_MAX;
+    case 6:
+      return INT_MAX;
+    default:
+      return fuzz_random(state) % 4000000000UL;
+  }
+}
+
+/*
+ * Write a random command, without its newline.
+ *
+ * @param state A pointer to the generator state.
+ * @param line Where to write it, at least `LINE_MAX` bytes.
+ */
+void fuzz_line(uint64_t *state, char *line) {
+  unsigned long n[4];
+
+  for (int k = 0; k < 4; ++k) n[k] = fuzz_number(state);
+
+  switch (fuzz_random(state) % 12) {
+    case 0:
+    case 1:
+      snprintf(line, LINE_MAX, "LINE %lu,%lu %lu,%lu", n[0], n[1], n[2], n[3]);
+      break;
+    case 2:
+    case 3:
+      snprintf(line, LINE_MAX, "CIRCLE %lu,%lu,%lu", n[0], n[1], n[2]);
+      break;
+    case 4:
+    case 5:
+      snprintf(line, LINE_MAX, "RECTANGLE %lu,%lu %lu,%lu", n[0], n[1], n[2], n[3]);
+      break;
+    case 6:
+      snprintf(line, LINE_MAX, "POINT %lu,%lu", n[0], n[1]);
+      break;
+    case 7:
+      snprintf(line, LINE_MAX, "CHAR %c", "#*+o"[fuzz_random(state) % 4]);
+      break;
+    case 8:
+      snprintf(line, LINE_MAX, "VIEW %lu,%lu %lu,%lu", n[0], n[1], n[2], n[3]);
+      break;
+    case 9:
+      snprintf(line, LINE_MAX, "ZOOM %lu", n[0] % 16);
+      break;
+    case 10:
+      snprintf(line, LINE_MAX, "CLEAR");
+      break;
+    default:
+      snprintf(line, LINE_MAX, "DISPLAY");
+      break;
+  }
+}
+
+/*
+ * Make a new random script, a grid followed by a few commands.
+ *
+ * @param state A pointer to the generator state.
+ * @param in A pointer to the input to fill in.
+ */
+void fuzz_generate(uint64_t *state, struct FuzzInput *in) {
+  char line[LINE_MAX];
+
+  size_t size;
+
+  FILE *f = open_memstream(&in->text, &size);
+
+  fprintf(
+    f,
+    "GRID %lu %lu\n",
+    1 + fuzz_random(state) % 1000,
+    1 + fuzz_random(state) % 1000
+  );
+
+  for (int k = 1 + fuzz_random(state) % 8; k > 0; --k) {
+    fuzz_line(state, line);
+    fprintf(f, "%s\n", line);
+  }
+
+  fclose(f);
+
+  in->size = size;
+}
+
+/*
+ * Make a variant of a script by changing a number, adding,
+ * repeating, dropping or swapping lines a few times over. The
+ * first line, its grid, only ever has its numbers changed.
+ *
+ * @param state A pointer to the generator state.
+ * @param from A pointer to the script to start from.
+ * @param in A pointer to the input to fill in.
+ */
+void fuzz_mutate(uint64_t *state, struct FuzzInput *from, struct FuzzInput *in) {
+  char *lines[FUZZ_LINES + 1], line[LINE_MAX], *text = strdup(from->text), *next = text;
+
+  int n = 0;
+
+  while (*next && n < FUZZ_LINES) {
+    lines[n++] = next;
+    next += strcspn(next, "\n");
+    if (*next) *next++ = 0;
+  }
+
+  char *added[8];
+
+  int adds = 0;
+
+  for (int times = 1 + fuzz_random(state) % 3; times > 0; --times) {
+    int k = (int)(fuzz_random(state) % n), j = 1 + (int)(fuzz_random(state) % n);
+
+    switch (fuzz_random(state) % 5) {
+      case 0: {
+        int digits[LINE_MAX / 2], runs = 0;
+
+        for (int c = 0; lines[k][c]; ++c)
+          if (isdigit((unsigned char)lines[k][c]) && (!c || !isdigit((unsigned char)lines[k][c - 1])))
+            digits[runs++] = c;
+
+        if (!runs) break;
+
+        int at = digits[fuzz_random(state) % runs], end = at;
+
+        while (isdigit((unsigned char)lines[k][end])) ++end;
+
+        unsigned long v = fuzz_random(state) % 2 ?
+          fuzz_number(state) :
+          strtoul(lines[k] + at, NULL, 10) * 10 + 9;
+
+        snprintf(line, sizeof(line), "%.*s%lu%s", at, lines[k], v, lines[k] + end);
+
+        lines[k] = added[adds++] = strdup(line);
+        break;
+      }
+      case 1:
+        if (n == FUZZ_LINES) break;
+        fuzz_line(state, line);
+        if (j > n) j = n;
+        memmove(lines + j + 1, lines + j, sizeof(char*) * (n - j));
+        lines[j] = added[adds++] = strdup(line);
+        ++n;
+        break;
+      case 2:
+        if (n == FUZZ_LINES || !k) break;
+        memmove(lines + k + 1, lines + k, sizeof(char*) * (n - k));
+        ++n;
+        break;
+      case 3:
+        if (n < 2 || !k) break;
+        memmove(lines + k, lines + k + 1, sizeof(char*) * (n - k - 1));
+        --n;
+        break;
+      default: {
+        if (!k || j >= n) break;
+        char *swap = lines[k];
+        lines[k] = lines[j];
+        lines[j] = swap;
+        break;
+      }
+    }
+  }
+
+  size_t size;
+
+  FILE *f = open_memstream(&in->text, &size);
+
+  for (int k = 0; k < n; ++k) fprintf(f, "%s\n", lines[k]);
+
+  fclose(f);
+
+  in->size = size;
+
+  for (int k = 0; k < adds; ++k) free(added[k]);
+
+  free(text);
+}
+
+/*
+ * Report a fuzzed script that ran out of time, charging the
+ * command it was stuck in, and stop.
+ *
+ * @param sig The signal number.
+ */
+void fuzz_timeout(int sig) {
+  (void)sig;
+
+  fuzz_child.cost.command[fuzz_child.cmd] += now() - fuzz_child.began;
+  fuzz_child.cost.ops[fuzz_child.cmd]++;
+  fuzz_child.cost.timed_out = 1;
+
+  write_all(fuzz_child.fd, (char*)&fuzz_child.cost, sizeof(fuzz_child.cost));
+
+  _exit(0);
+}
+
+/*
+ * Run a fuzzed script in a child process with its output thrown
+ * away, and measure the CPU time and peak memory it took.
+ *
+ * @param in A pointer to the input.
+ * @param i The interpreter the script starts out with.
+ * @param baseline The peak memory of a child that does nothing.
+ */
+void fuzz_run(struct FuzzInput *in, struct Interpreter i, long baseline) {
+  int pipes[2];
+
+  pipe(pipes);
+
+  fflush(NULL);
+
+  pid_t pid = fork();
+
+  if (!pid) {
+    struct rlimit limit = { FUZZ_MEMORY, FUZZ_MEMORY };
+
+    struct Script script = { 0 };
+
+    close(pipes[0]);
+
+    setrlimit(RLIMIT_AS, &limit);
+    freopen("/dev/null", "w", stdout);
+
+    fuzz_child.fd = pipes[1];
+
+    signal(SIGALRM, fuzz_timeout);
+    alarm(FUZZ_TIMEOUT);
+
+    compile_text(NULL, in->text, in->size, &script);
+
+    for (size_t k = 0; k < script.size && script.ops[k].cmd != END; ++k) {
+      fuzz_child.cmd = script.ops[k].cmd;
+      fuzz_child.began = now();
+
+      load(&i, script.ops[k]);
+      eval(&i);
+
+      fuzz_child.cost.command[fuzz_child.cmd] += now() - fuzz_child.began;
+      fuzz_child.cost.ops[fuzz_child.cmd]++;
+    }
+
+    alarm(0);
+
+    write_all(pipes[1], (char*)&fuzz_child.cost, sizeof(fuzz_child.cost));
+
+    _exit(0);
+  }
+
+  close(pipes[1]);
+
+  in->cost = (struct FuzzCost) { 0 };
+
+  if (!read_all(pipes[0], &in->cost, sizeof(in->cost))) in->cost.crashed = 1;
+
+  close(pipes[0]);
+
+  int status;
+
+  struct rusage usage;
+
+  wait4(pid, &status, 0, &usage);
+
+  in->cost.seconds = (
+    usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6
+  );
+  in->cost.memory = usage.ru_maxrss * 1024L - baseline;
+
+  if (in->cost.memory < 0) in->cost.memory = 0;
+}
+
+/*
+ * How costly an input is per byte of it, by time or by memory.
+ *
+ * @param in A pointer to the input.
+ * @param memory Whether to score memory rather than time.
+ * @return The score.
+ */
+double fuzz_score(struct FuzzInput *in, int memory) {
+  return (memory ? (double)in->cost.memory : in->cost.seconds) / in->size;
+}
+
+/*
+ * Keep a copy of an input among the costliest, if it is costly
+ * enough.
+ *
+ * @param kept The costliest inputs so far, costliest first.
+ * @param n A pointer to how many there are.
+ * @param in A pointer to the input.
+ * @param memory Whether to rank by memory rather than time.
+ */
+void fuzz_keep(struct FuzzInput *kept, int *n, struct FuzzInput *in, int memory) {
+  double score = fuzz_score(in, memory);
+
+  if (*n == FUZZ_KEEP && score <= fuzz_score(&kept[*n - 1], memory)) return;
+
+  for (int k = 0; k < *n; ++k)
+    if (!strcmp(kept[k].text, in->text)) return;
+
+  if (*n == FUZZ_KEEP) free(kept[--*n].text);
+
+  int k = (*n)++;
+
+  for (; k > 0 && fuzz_score(&kept[k - 1], memory) < score; --k)
+    kept[k] = kept[k - 1];
+
+  kept[k] = *in;
+  kept[k].text = strdup(in->text);
+}
+
+/*
+ * Print the costliest inputs of a ranking with what each of
+ * their commands took, and save them in a directory.
+ *
+ * @param dir The directory.
+ * @param name What the ranking is called.
+ * @param kept The inputs, costliest first.
+ * @param n How many there are.
+ * @param memory Whether they are ranked by memory rather than time.
+ */
+void fuzz_report(const char *dir, const char *name, struct FuzzInput *kept, int n, int memory) {
+  char path[PATH_MAX];
+
+  fprintf(out(), "%s per byte:\n", memory ? "most memory" : "slowest");
+
+  for (int k = 0; k < n; ++k) {
+    struct FuzzInput *in = &kept[k];
+
+    snprintf(path, sizeof(path), "%s/%s-%d.txt", dir, name, k + 1);
+
+    FILE *f = fopen(path, "w");
+
+    if (f) {
+      fwrite(in->text, 1, in->size, f);
+      fclose(f);
+    }
+
+    fprintf(
+      out(),
+      "%3d. %s: %zu bytes, %.3fs, %.1fMB%s%s\n",
+      k + 1,
+      path,
+      in->size,
+      in->cost.seconds,
+      in->cost.memory / 1048576.0,
+      in->cost.timed_out ? ", timed out" : "",
+      in->cost.crashed ? ", crashed" : ""
+    );
+
+    double total = 0;
+
+    for (int c = 0; c < COMMANDS; ++c) total += in->cost.command[c];
+
+    for (int c = 0; c < COMMANDS; ++c)
+      if (in->cost.ops[c])
+        fprintf(
+          out(),
+          "       %-9s %4lu ops %9.3fs %5.1f%%\n",
+          command_name((enum Command)c),
+          in->cost.ops[c],
+          in->cost.command[c],
+          total > 0 ? 100 * in->cost.command[c] / total : 0
+        );
+  }
+}
+
+/*
+ * Search for scripts that are as slow or take as much memory as
+ * possible for their length.
+ *
+ * Scripts are made up at random or mutated from the costliest
+ * ones found so far, and each is run in a child process that is
+ * stopped if it takes too long. The costliest are reported with
+ * where their time went and saved to a directory.
+ *
+ * @param dir The directory to save the costliest scripts in.
+ * @param runs How many scripts to try.
+ * @param i The interpreter every script starts out with.
+ * @return The exit status.
+ */
+int fuzz(const char *dir, int runs, struct Interpreter i) {
+  struct FuzzInput slowest[FUZZ_KEEP], hungriest[FUZZ_KEEP], in = { 0 };
+
+  int slow = 0, hungry = 0, timeouts = 0, crashes = 0;
+
+  uint64_t seed = (uint64_t)time(NULL) * 2654435761u | 1, state = seed;
+
+  double start = now();
+
+  if (mkdir(dir, 0777) && errno != EEXIST) {
+    fprintf(stderr, "error: Can't create `%s`\n", dir);
+    return 1;
   }
 
-  if (y1 > y2) {
-    int temp = y1;
-    y1 = y2;
-    y2 = temp;
+  i.grid.pool = NULL;
+
+  in.text = strdup("");
+
+  fuzz_run(&in, i, 0);
+
+  long baseline = in.cost.memory;
+
+  free(in.text);
+
+  for (int run = 0; run < runs; ++run) {
+    uint64_t pick = fuzz_random(&state);
+
+    if (!slow || pick % 4 == 0)
+      fuzz_generate(&state, &in);
+    else if (pick % 4 == 1 && hungry)
+      fuzz_mutate(&state, &hungriest[(pick >> 8) % hungry], &in);
+    else
+      fuzz_mutate(&state, &slowest[(pick >> 8) % slow], &in);
+
+    fuzz_run(&in, i, baseline);
+
+    timeouts += in.cost.timed_out;
+    crashes += in.cost.crashed;
+
+    if (!in.cost.crashed) {
+      fuzz_keep(slowest, &slow, &in, 0);
+      fuzz_keep(hungriest, &hungry, &in, 1);
+    }
+
+    free(in.text);
   }
 
-  line(grid, (int[]) { x1 + abs(x2 - x1), y1, x2, y2 });
-  line(grid, (int[]) { x1, y1 + abs(y2 - y1), x1, y1 });
-  line(grid, (int[]) { x1, y1, x1 + abs(x2 - x1), y1 });
-  line(grid, (int[]) { x2, y2, x1, y1 + abs(y2 - y1) });
+  fprintf(
+    out(),
+    "fuzz: %d runs in %.1fs, %d timed out, %d crashed, seed %llu\n",
+    runs,
+    now() - start,
+    timeouts,
+    crashes,
+    (unsigned long long)seed
+  );
+
+  fuzz_report(dir, "slow", slowest, slow, 0);
+  fuzz_report(dir, "memory", hungriest, hungry, 1);
+
+  return 0;
 }
 
 /*
- * The line parser responsible for turning lines read
- * from standard input into valid `Operation` structs.
+ * The knobs of a generated workload.
  */
-struct Parser {
-  char line[LINE_MAX];
+struct Workload {
+  const char *kind;
+  int width;
+  int height;
+  int shapes;
+  int frames;
+  double overlap;
+  double offcanvas;
+  uint64_t state;
+  int x;
+  int y;
 };
 
 /*
- * Read a line in from standard input and set it on the
- * passed in parser.
+ * A uniformly random fraction.
  *
- * @param parser A pointer to a parser.
+ * @param w A pointer to the workload.
+ * @return A number in `[0, 1)`.
  */
-void read(struct Parser *parser) {
-  fgets(parser->line, LINE_MAX, stdin);
-  parser->line[strcspn(parser->line, "\n")] = 0;
+double workload_chance(struct Workload *w) {
+  return (fuzz_random(&w->state) >> 11) * (1.0 / (1ULL << 53));
 }
 
 /*
- * Parse the current string that's set on the passed
- * in parser.
+ * A random number below a bound.
  *
- * It first splits on spaces `' '` and then handles each
- * individual token by splitting on commas `,`.
+ * @param w A pointer to the workload.
+ * @param n The bound, at least 1.
+ * @return The number.
+ */
+int workload_below(struct Workload *w, int n) {
+  return n > 0 ? (int)(fuzz_random(&w->state) % (uint64_t)n) : 0;
+}
+
+/*
+ * Pick where the next shape goes, close to the last one as
+ * often as the workload overlaps and off the canvas as often
+ * as it asks for.
  *
- * @param parser A parser struct.
- * @return The parsed operation.
+ * @param w A pointer to the workload.
+ * @param x Set to the column.
+ * @param y Set to the row.
  */
-struct Operation parse(struct Parser parser) {
-  char *inner, *outer;
+void workload_point(struct Workload *w, int *x, int *y) {
+  if (workload_chance(w) < w->overlap) {
+    *x = w->x + workload_below(w, w->width / 8 + 1) - w->width / 16;
+    *y = w->y + workload_below(w, w->height / 8 + 1) - w->height / 16;
+  } else {
+    *x = workload_below(w, w->width);
+    *y = workload_below(w, w->height);
+  }
 
-  struct Operation operation;
+  if (workload_chance(w) < w->offcanvas) {
+    if (workload_below(w, 2)) *x += w->width;
+    else *y += w->height;
+  }
+
+  if (*x < 0) *x = 0;
+  if (*y < 0) *y = 0;
+
+  w->x = *x;
+  w->y = *y;
+}
+
+/*
+ * Write a label one character at a time, as scripts do.
+ *
+ * @param x The column of the first character.
+ * @param y The row.
+ * @param text The label, without digits since `CHAR` reads those
+ *             as a character code.
+ */
+void workload_text(int x, int y, const char *text) {
+  for (int k = 0; text[k]; ++k) {
+    if (text[k] == ' ') continue;
+    fprintf(out(), "CHAR %c\nPOINT %d,%d\n", text[k], x + k, y);
+  }
 
-  char *token = strtok_r(parser.line, " ", &outer);
+  fprintf(out(), "CHAR *\n");
+}
 
-  operation.name = strdup(token);
-  operation.cmd = command_from_string(token);
+/*
+ * A frame of a dashboard, titled panels in a grid each holding a
+ * few bars.
+ *
+ * @param w A pointer to the workload.
+ */
+void workload_dashboard(struct Workload *w) {
+  static const char *titles[] = { "CPU", "MEMORY", "DISK IO", "NETWORK", "LOAD", "REQUESTS", "ERRORS", "LATENCY" };
 
-  int index = 0;
+  int panels = w->shapes / 12 + 1, cols = 1;
 
-  for (;;) {
-    token = strtok_r(NULL, " ", &outer);
+  while (cols * cols < panels) ++cols;
 
-    if (!token) break;
+  int rows = (panels + cols - 1) / cols;
+  int cw = w->width / cols, ch = w->height / rows;
+  int grow = (int)(w->overlap * (cw < ch ? cw : ch));
 
-    char *local = strtok_r(token, ",", &inner);
+  for (int k = 0; k < panels; ++k) {
+    int x = (k % cols) * cw, y = (k / cols) * ch;
+    int x2 = x + cw - 1 + grow, y2 = y + ch - 1 + grow;
 
-    while (local) {
-      operation.args[index++] = isdigit(*local) ?
-        atoi(local) :
-        (int)*local;
-      local = strtok_r(NULL, ",", &inner);
+    if (workload_chance(w) < w->offcanvas) {
+      x += w->width / 2;
+      x2 += w->width / 2;
     }
+
+    fprintf(out(), "RECTANGLE %d,%d %d,%d\n", x, y, x2, y2);
+
+    workload_text(x + 1, y + ch - 2, titles[k % (sizeof(titles) / sizeof(titles[0]))]);
+
+    for (int bar = 0; bar < 3 && y + 1 + bar < y2 - 1; ++bar)
+      fprintf(out(), "LINE %d,%d %d,%d\n", x + 1, y + 1 + bar, x + 1 + workload_below(w, cw - 1), y + 1 + bar);
   }
+}
 
-  return operation;
+/*
+ * A frame of a network diagram, circled nodes joined by lines.
+ *
+ * @param w A pointer to the workload.
+ */
+void workload_network(struct Workload *w) {
+  int nodes = w->shapes / 4 + 2, edges = w->shapes - nodes;
+
+  int *xs = (int*)malloc(sizeof(int) * nodes), *ys = (int*)malloc(sizeof(int) * nodes);
+
+  for (int k = 0; k < nodes; ++k) {
+    workload_point(w, &xs[k], &ys[k]);
+    fprintf(out(), "CIRCLE %d,%d,%d\n", xs[k], ys[k], 1 + workload_below(w, 4));
+  }
+
+  for (int k = 0; k < edges; ++k) {
+    int a = workload_below(w, nodes), b = workload_below(w, nodes);
+    fprintf(out(), "LINE %d,%d %d,%d\n", xs[a], ys[a], xs[b], ys[b]);
+  }
+
+  free(xs);
+  free(ys);
 }
 
 /*
- * The struct responsible for evaluating operations
- * parsed by the parser.
+ * A frame of a time-series chart, axes and a few random walks
+ * drawn as connected segments.
+ *
+ * @param w A pointer to the workload.
  */
-struct Interpreter {
-  struct Grid grid;
-  struct Operation op;
-};
+void workload_chart(struct Workload *w) {
+  static const char marks[] = "*+ox#@";
+
+  int step = 2, steps = (w->width - 1) / step;
+
+  if (steps < 1) steps = 1;
+
+  int series = w->shapes / steps + 1;
+  int band = (int)((1 - w->overlap) * w->height / series);
+
+  fprintf(out(), "LINE 0,0 0,%d\nLINE 0,0 %d,0\n", w->height - 1, w->width - 1);
+
+  for (int s = 0; s < series; ++s) {
+    int base = s * band + workload_below(w, w->height / 4 + 1), y = base;
+
+    fprintf(out(), "CHAR %c\n", marks[s % (sizeof(marks) - 1)]);
+
+    for (int k = 0; k < steps; ++k) {
+      int next = y + workload_below(w, 7) - 3;
+
+      if (next < 1) next = 1;
+      if (workload_chance(w) < w->offcanvas) next += w->height;
+      else if (next >= w->height) next = w->height - 1;
+
+      fprintf(out(), "LINE %d,%d %d,%d\n", 1 + k * step, y, 1 + (k + 1) * step, next);
+
+      y = next >= w->height ? base : next;
+    }
+  }
+
+  fprintf(out(), "CHAR *\n");
+}
 
 /*
- * Load an operation onto the passed in interpreter.
+ * A frame of dense art, large overlapping shapes of every kind.
  *
- * @param i A pointer to an interpreter.
- * @param op An operation struct.
+ * @param w A pointer to the workload.
  */
-void load(struct Interpreter *i, struct Operation op) {
-  i->op = op;
+void workload_art(struct Workload *w) {
+  static const char inks[] = "*#o+.x";
+
+  int size = (w->width < w->height ? w->width : w->height) / 2 + 1;
+
+  for (int k = 0; k < w->shapes; ++k) {
+    int x, y, x2, y2;
+
+    workload_point(w, &x, &y);
+
+    if (k % 16 == 0) fprintf(out(), "CHAR %c\n", inks[workload_below(w, sizeof(inks) - 1)]);
+
+    switch (workload_below(w, 3)) {
+      case 0:
+        fprintf(out(), "CIRCLE %d,%d,%d\n", x, y, 1 + workload_below(w, size));
+        break;
+      case 1:
+        x2 = x + workload_below(w, size);
+        y2 = y + workload_below(w, size);
+        fprintf(out(), "RECTANGLE %d,%d %d,%d\n", x, y, x2, y2);
+        break;
+      default:
+        workload_point(w, &x2, &y2);
+        fprintf(out(), "LINE %d,%d %d,%d\n", x, y, x2, y2);
+        break;
+    }
+  }
 }
 
 /*
- * Evaluate the operation that's present on the passed in
- * interpreter.
+ * Print a synthetic script modeled on how asciidraw gets used.
  *
- * This method essentially associates commands with their
- * corresponding methods on `Grid`.
+ * The spec is a kind, `dashboard`, `network`, `chart` or `art`,
+ * optionally followed by comma separated settings: `width`,
+ * `height`, `shapes` per frame, `frames`, the `overlap` and
+ * `offcanvas` fractions and the `seed`.
  *
- * @param i A pointer to an interpreter.
+ * @param spec The workload spec.
+ * @return The exit status.
  */
-void eval(struct Interpreter *i) {
-  switch (i->op.cmd) {
-    case CHAR:
-      character(&i->grid, i->op.args);
-      break;
-    case CIRCLE:
-      circle(&i->grid, i->op.args);
-      break;
-    case CLEAR:
-      clear(&i->grid);
-      break;
-    case DISPLAY:
-      display(i->grid);
-      break;
-    case END:
-      exit(0);
-    case GRID:
-      grid(&i->grid, i->op.args);
-      break;
-    case INVALID:
-      printf("error: Invalid command `%s`\n", i->op.name);
-      break;
-    case LINE:
-      line(&i->grid, i->op.args);
-      break;
-    case POINT:
-      point(&i->grid, i->op.args);
-      break;
-    case RECTANGLE:
-      rectangle(&i->grid, i->op.args);
-      break;
+int generate(const char *spec) {
+  struct Workload w = {
+    .width = 200,
+    .height = 100,
+    .shapes = 1000,
+    .frames = 1,
+    .overlap = 0.2,
+    .offcanvas = 0.05,
+    .state = 1
+  };
+
+  char *copy = strdup(spec), *save;
+
+  w.kind = strtok_r(copy, ",", &save);
+
+  for (char *setting; (setting = strtok_r(NULL, ",", &save));) {
+    char *value = strchr(setting, '=');
+
+    if (!value) {
+      fprintf(stderr, "error: Expected `key=value`, got `%s`\n", setting);
+      return 1;
+    }
+
+    *value++ = 0;
+
+    if (!strcmp(setting, "width")) w.width = atoi(value);
+    else if (!strcmp(setting, "height")) w.height = atoi(value);
+    else if (!strcmp(setting, "shapes")) w.shapes = atoi(value);
+    else if (!strcmp(setting, "frames")) w.frames = atoi(value);
+    else if (!strcmp(setting, "overlap")) w.overlap = atof(value);
+    else if (!strcmp(setting, "offcanvas")) w.offcanvas = atof(value);
+    else if (!strcmp(setting, "seed")) w.state = strtoull(value, NULL, 10) * 2654435761u | 1;
+    else {
+      fprintf(stderr, "error: Unknown workload setting `%s`\n", setting);
+      return 1;
+    }
+  }
+
+  void (*frame)(struct Workload *w) = NULL;
+
+  if (!w.kind) frame = NULL;
+  else if (!strcmp(w.kind, "dashboard")) frame = workload_dashboard;
+  else if (!strcmp(w.kind, "network")) frame = workload_network;
+  else if (!strcmp(w.kind, "chart")) frame = workload_chart;
+  else if (!strcmp(w.kind, "art")) frame = workload_art;
+
+  if (!frame) {
+    fprintf(stderr, "error: Unknown workload `%s`\n", w.kind ? w.kind : "");
+    return 1;
+  }
+
+  if (w.width <= 0 || w.height <= 0 || w.shapes < 0 || w.frames <= 0) {
+    fprintf(stderr, "error: Workload sizes must be positive\n");
+    return 1;
+  }
+
+  fprintf(out(), "GRID %d %d\n", w.width, w.height);
+
+  for (int k = 0; k < w.frames; ++k) {
+    if (k) fprintf(out(), "CLEAR\n");
+    frame(&w);
+    fprintf(out(), "DISPLAY\n");
   }
+
+  fprintf(out(), "END\n");
+
+  free(copy);
+
+  return 0;
 }
 
 /*
  * The program entrypoint.
  */
-int main() {
+int main(int argc, char **argv) {
   struct Parser parser;
 
+  struct Pool pool;
+
+  int threads = 1;
+
+  unsigned long cold = 0;
+
+  enum Render render = RENDER_BANDS;
+
+  const char *viewers_path = NULL, *metrics_path = NULL, *session = NULL;
+
+  int shards = 0, workers = (int)sysconf(_SC_NPROCESSORS_ONLN), scripts = 0;
+
+  const char *archive = NULL, *sessions_path = NULL, *profile_path = NULL, *fuzz_dir = NULL,
+             *record_path = NULL;
+
+  int runs = 1000;
+
+  int line = 0;
+
+  char **paths = (char**)malloc(argc * sizeof(char*));
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+      if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    } else if (!strcmp(argv[i], "--render") && i + 1 < argc) {
+      ++i;
+      if (!strcmp(argv[i], "bands")) render = RENDER_BANDS;
+      else if (!strcmp(argv[i], "dag")) render = RENDER_DAG;
+      else if (!strcmp(argv[i], "stamps")) render = RENDER_STAMPS;
+      else {
+        fprintf(stderr, "error: Unknown render mode `%s`\n", argv[i]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--cold") && i + 1 < argc) {
+      cold = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--viewers") && i + 1 < argc) {
+      viewers_path = argv[++i];
+    } else if (!strcmp(argv[i], "--serve") && i + 1 < argc) {
+      session = argv[++i];
+    } else if (!strcmp(argv[i], "--shard") && i + 1 < argc) {
+      shards = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--metrics") && i + 1 < argc) {
+      metrics_path = argv[++i];
+    } else if (!strcmp(argv[i], "--generate") && i + 1 < argc) {
+      return generate(argv[++i]);
+    } else if (!strcmp(argv[i], "--fuzz") && i + 1 < argc) {
+      fuzz_dir = argv[++i];
+    } else if (!strcmp(argv[i], "--runs") && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+      profile_path = argv[++i];
+    } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (!strcmp(argv[i], "--sessions") && i + 1 < argc) {
+      sessions_path = argv[++i];
+    } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+      archive = argv[++i];
+    } else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+      workers = atoi(argv[++i]);
+      if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    } else if (strncmp(argv[i], "--", 2)) {
+      paths[scripts++] = argv[i];
+    } else {
+      fprintf(
+        stderr,
+        "usage: %s [--threads N] [--render bands|dag|stamps] [--cold N]"
+        " [--viewers PATH] [--serve PATH] [--sessions PATH] [--shard N]"
+        " [--metrics PATH|PORT] [--profile PATH] [--record FILE] [--fuzz DIR [--runs N]]"
+        " [--generate KIND[,SETTING=VALUE...]]"
+        " [--batch ARCHIVE [--workers N] SCRIPT...] [SCRIPT]\n",
+        argv[0]
+      );
+      return 1;
+    }
+  }
+
   struct Interpreter interpreter = {
     .grid = {
       .character = '*',
-      .initialized = 0
+      .initialized = 0,
+      .pool = &pool,
+      .render = render,
+      .cold = cold
     }
   };
 
+  if ((archive || sessions_path || shards > 1 || fuzz_dir) && (viewers_path || session)) {
+    fprintf(
+      stderr,
+      "error: --batch, --sessions, --shard and --fuzz can't be combined with --viewers or --serve\n"
+    );
+    return 1;
+  }
+
+  if (!archive && scripts > 1) {
+    fprintf(stderr, "error: More than one script can only be given with --batch\n");
+    return 1;
+  }
+
+  if (!archive && scripts && (session || sessions_path || shards > 1)) {
+    fprintf(stderr, "error: A script can't be combined with --serve, --sessions or --shard\n");
+    return 1;
+  }
+
+  if (profile_path && (archive || sessions_path || shards > 1 || fuzz_dir || viewers_path || session)) {
+    fprintf(stderr, "error: --profile only works on a single interpreter\n");
+    return 1;
+  }
+
+  if (metrics_path && (archive || fuzz_dir)) {
+    fprintf(stderr, "error: --metrics can't be combined with --batch or --fuzz\n");
+    return 1;
+  }
+
+  if (record_path && (archive || sessions_path || shards > 1 || fuzz_dir)) {
+    fprintf(stderr, "error: --record can't be combined with --batch, --sessions, --shard or --fuzz\n");
+    return 1;
+  }
+
+  if (record_path) {
+    if (!recorder_init(&recorder, record_path)) {
+      fprintf(stderr, "error: Can't create `%s`\n", record_path);
+      return 1;
+    }
+
+    interpreter.recorder = &recorder;
+
+    atexit(record_finish);
+  }
+
+  if (viewers_path) {
+    interpreter.publisher = (struct Publisher*)malloc(sizeof(struct Publisher));
+
+    if (!publisher_init(interpreter.publisher, viewers_path)) {
+      fprintf(stderr, "error: Can't listen on `%s`\n", viewers_path);
+      return 1;
+    }
+  }
+
+  if (metrics_path && shards <= 1 && !metrics(metrics_path)) {
+    fprintf(stderr, "error: Can't listen on `%s`\n", metrics_path);
+    return 1;
+  }
+
+  if (sessions_path && !sessions(sessions_path, interpreter)) {
+    fprintf(stderr, "error: Can't listen on `%s`\n", sessions_path);
+    return 1;
+  }
+
+  if (archive)
+    return batch(archive, paths, scripts, workers, threads, interpreter);
+
+  if (fuzz_dir)
+    return fuzz(fuzz_dir, runs, interpreter);
+
+  if (shards > 1)
+    shard(shards, threads, interpreter, metrics_path);
+
+  pool_init(&pool, threads);
+
+  if (profile_path) profile(profile_path);
+
+  if (scripts) {
+    struct Script script;
+
+    int compiled;
+
+    PROFILE("compile", compiled = compile(&pool, paths[0], &script));
+
+    if (!compiled) {
+      fprintf(stderr, "error: Can't open `%s`\n", paths[0]);
+      return 1;
+    }
+
+    run(&interpreter, &script);
+
+    return 0;
+  }
+
+  if (session && !serve(&interpreter, session)) {
+    fprintf(stderr, "error: Can't listen on `%s`\n", session);
+    return 1;
+  }
+
   for (;;) {
     // Display the prompt
-    printf("> ");
+    fprintf(out(), "> ");
 
     // Read a line in from stdin
-    read(&parser);
+    read_line(&parser);
 
     // Load the operation onto the interpreter
     load(&interpreter, parse(parser));
 
     // Evaluate the currently loaded operation
+    profile_enter("stdin", ++line);
     eval(&interpreter);
+    profile_leave();
+
+    // Release the operation's strings
+    operation_free(&interpreter.op);
   }
 }